@@ -2,17 +2,15 @@
 #include <opencv2/opencv.hpp>
 #include <json/json.h>
 #include <fstream>
+#include <string>
 #include <vector>
 #include <RtMidi.h>
 
-// Platform-dependent sleep routines.
-#if defined(_WIN32)
-#include <windows.h>
-#define SLEEP( milliseconds ) Sleep( (DWORD) milliseconds ) 
-#else // Unix variants
-#include <unistd.h>
-#define SLEEP( milliseconds ) usleep( (unsigned long) (milliseconds * 1000.0) )
-#endif
+#include "FrameCapture.h"
+#include "MidiEngine.h"
+#include "Pipeline.h"
+#include "TileLayout.h"
+#include "TileOverlay.h"
 
 static bool chooseMidiPort(RtMidiOut* rtmidi)
 {
@@ -66,76 +64,14 @@ static RtMidi::Api chooseMidiApi()
 	return static_cast<RtMidi::Api>(i);
 }
 
-static void playNote(RtMidiOut* midiout, int note)
-{
-	std::vector<unsigned char> message(3);
-
-	// Note On: 144, 64, 90
-	message[0] = 144;
-	message[1] = note;
-	message[2] = 90;
-	midiout->sendMessage(&message);
-
-	SLEEP(1);
-
-	// Note Off: 128, 64, 0
-	message[0] = 128;
-	message[1] = note;
-	message[2] = 0;
-	midiout->sendMessage(&message);
-}
-
 static void createAndSetTrackbar(const cv::String& trackbarname, const cv::String& winname, int value, int count)
 {
 	cv::createTrackbar(trackbarname, winname, nullptr, count);
 	cv::setTrackbarPos(trackbarname, winname, value);
 }
 
-static int maxContour(std::vector<std::vector<cv::Point>>& contours)
-{
-	int maxAreaIndex = 0;
-	for (int i = 0; i < contours.size(); i++)
-	{
-		if (cv::contourArea(contours[i]) > cv::contourArea(contours[maxAreaIndex]))
-		{
-			maxAreaIndex = i;
-		}
-	}
-	return maxAreaIndex;
-}
-
-static void setGreen(std::vector<cv::Scalar>& tileColor, int index, bool isMute = false)
-{
-	cv::Scalar grey(122, 122, 122);
-	cv::Scalar green(0, 256, 0);
-	cv::Scalar red(0, 0, 256);
-
-	for (int i = 0; i < tileColor.size(); i++)
-	{
-		tileColor[i] = grey;
-	}
-	if (isMute == true)
-	{
-		tileColor[index] = red;
-		return;
-	}
-	tileColor[index] = green;
-}
-
 int main() {
-	cv::Mat image;
-	cv::Mat mask;
-	cv::VideoCapture cap(0);
-	int track = 80;
-	bool hasPlayed = false;
-
-	if (!cap.isOpened())
-	{
-		std::cout << "Cannot open camera";
-	}
-
 	RtMidiOut* midiout = 0;
-	std::vector<unsigned char> message;
 
 	// RtMidiOut constructor
 	try {
@@ -160,192 +96,178 @@ int main() {
 	Json::Value data;
 	reader.parse(f, data);
 
-	Json::Value jsonobj = data["highlighter"];
-	std::vector<int> obj(6, 0);
-
-	for (int i = 0; i < 6; i++)
+	// Every six-value entry is a marker colour, "highlighter" being the default
+	std::vector<MarkerColour> colours = loadMarkerColours(data);
+	if (colours.empty())
 	{
-		obj[i] = jsonobj[i].asInt();
+		std::cout << "No marker colours in object.json, using the highlighter defaults" << std::endl;
+		colours.push_back({ "highlighter", { { 20, 59, 194 }, { 69, 163, 255 } } });
 	}
+	ColourClassifier classifier(colours);
 
 	// Creating the trackbars needed for adjusting the marker colour
+	const HsvBounds& obj = colours[0].bounds;
 	cv::namedWindow("Set HSV");
-	createAndSetTrackbar("Upper Hue", "Set HSV", obj[0], 180);
-	createAndSetTrackbar("Upper Saturation", "Set HSV", obj[1], 255);
-	createAndSetTrackbar("Upper Value", "Set HSV", obj[2], 255);
-	createAndSetTrackbar("Lower Hue", "Set HSV", obj[3], 180);
-	createAndSetTrackbar("Lower Saturation", "Set HSV", obj[4], 255);
-	createAndSetTrackbar("Lower Value", "Set HSV", obj[5], 255);
+	if (colours.size() > 1)
+	{
+		createAndSetTrackbar("Marker", "Set HSV", 0, static_cast<int>(colours.size()) - 1);
+	}
+	createAndSetTrackbar("Upper Hue", "Set HSV", obj.upper[0], 180);
+	createAndSetTrackbar("Upper Saturation", "Set HSV", obj.upper[1], 255);
+	createAndSetTrackbar("Upper Value", "Set HSV", obj.upper[2], 255);
+	createAndSetTrackbar("Lower Hue", "Set HSV", obj.lower[0], 180);
+	createAndSetTrackbar("Lower Saturation", "Set HSV", obj.lower[1], 255);
+	createAndSetTrackbar("Lower Value", "Set HSV", obj.lower[2], 255);
+
+	// The playing surface, or the classic tracks and patterns without one
+	TileLayout layout = TileLayout::defaultLayout();
+	std::ifstream layoutFile("layout.json");
+	if (layoutFile)
+	{
+		Json::Value layoutData;
+		if (reader.parse(layoutFile, layoutData))
+		{
+			layout = TileLayout::fromJson(layoutData);
+		}
+		else
+		{
+			std::cout << "Cannot parse layout.json, using the default layout" << std::endl;
+		}
+	}
 
-	cv::Scalar grey(122, 122, 122);
-	cv::Scalar green(0, 256, 0);
-	cv::Scalar red(0, 0, 256);
-	cv::Scalar white(256, 256, 256);
+	TileOverlay overlay(layout);
 
-	std::vector<cv::Scalar> patColor(5, grey);
-	std::vector<cv::Scalar> trkColor(4, grey);
+	PipelineConfig config = PipelineConfig::fromJson(data);
 
-	while (true)
+	FrameCapture capture(config.camera);
+	if (!capture.isOpened())
 	{
-		cap >> image;
-		cap >> mask;
-		cv::flip(image, image, 1);
-		cv::flip(mask, mask, 1);
-
-		// Adding the colour buttons to the live frame for colour access
-		// Patterns
-		cv::rectangle(image, cv::Point(80, 1), cv::Point(160, 80), patColor[0], -1);
-		cv::rectangle(image, cv::Point(175, 1), cv::Point(255, 80), patColor[1], -1);
-		cv::rectangle(image, cv::Point(270, 1), cv::Point(350, 80), patColor[2], -1);
-		cv::rectangle(image, cv::Point(365, 1), cv::Point(445, 80), patColor[3], -1);
-		cv::rectangle(image, cv::Point(460, 1), cv::Point(540, 80), patColor[4], -1);
-
-		// Tracks
-		cv::rectangle(image, cv::Point(1, 80), cv::Point(80, 160), trkColor[0], -1);
-		cv::rectangle(image, cv::Point(1, 175), cv::Point(80, 255), trkColor[1], -1);
-		cv::rectangle(image, cv::Point(1, 270), cv::Point(80, 350), trkColor[2], -1);
-		cv::rectangle(image, cv::Point(1, 365), cv::Point(80, 445), trkColor[3], -1);
-
-		// Tile Text
-		cv::putText(image, "PAT 1", cv::Point(96, 33), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-		cv::putText(image, "PAT 2", cv::Point(190, 33), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-		cv::putText(image, "PAT 3", cv::Point(290, 33), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-		cv::putText(image, "PAT 4", cv::Point(380, 33), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-		cv::putText(image, "MUTE", cv::Point(480, 33), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-
-		cv::putText(image, "TRACK 1", cv::Point(8, 115), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-		cv::putText(image, "TRACK 2", cv::Point(8, 210), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-		cv::putText(image, "TRACK 3", cv::Point(8, 305), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-		cv::putText(image, "TRACK 4", cv::Point(8, 400), cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
-
-		// Image Processing
-		int u_hue = cv::getTrackbarPos("Upper Hue", "Set HSV");
-		int u_saturation = cv::getTrackbarPos("Upper Saturation", "Set HSV");
-		int u_value = cv::getTrackbarPos("Upper Value", "Set HSV");
-		int l_hue = cv::getTrackbarPos("Lower Hue", "Set HSV");
-		int l_saturation = cv::getTrackbarPos("Lower Saturation", "Set HSV");
-		int l_value = cv::getTrackbarPos("Lower Value", "Set HSV");
-
-		cv::Scalar upperHsv(u_hue, u_saturation, u_value);
-		cv::Scalar lowerHsv(l_hue, l_saturation, l_value);
-		cv::Mat element = cv::getStructuringElement(0, cv::Size(5, 5));
-
-		cv::cvtColor(mask, mask, cv::COLOR_BGR2HSV);
-		cv::inRange(mask, lowerHsv, upperHsv, mask);
-
-		//erosion_type = MORPH_RECT
-		cv::erode(mask, mask, element);
-
-		//morph_type = Opening
-		cv::morphologyEx(mask, mask, 0, element);
-
-		//dilation_type = MORPH_RECT
-		cv::dilate(mask, mask, element);
-
-		// Find contours
-		std::vector<std::vector<cv::Point>> contours;
-		cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-
-		if (contours.size() > 0)
-		{
-			int contour_index = maxContour(contours);
-			std::vector<cv::Point> cnt = contours[contour_index];
+		std::cout << "Cannot open camera";
+	}
 
-			cv::Point2f center;
-			float radius;
-			cv::minEnclosingCircle(cnt, center, radius);
-			cv::circle(image, center, int(radius), cv::Scalar(0, 255, 255), 2);
+	// How long frames take to get through each stage, and notes to get out
+	LatencyReport latency;
+	MidiEngine midi(midiout, config.midiEvents.capacity, config.midiEvents.policy, config.midiOutput, latency);
+	midi.start();
 
-			if (center.x <= 80)
-			{
-				if ((80 <= center.y) && (center.y <= 160))
-				{
-					track = 80;
-					setGreen(trkColor, 0);
-				}
-				else if ((175 <= center.y) && (center.y <= 255))
-				{
-					track = 70;
-					setGreen(trkColor, 1);
-				}
-				else if ((270 <= center.y) && (center.y <= 350))
-				{
-					track = 60;
-					setGreen(trkColor, 2);
-				}
-				else if ((365 <= center.y) && (center.y <= 445))
-				{
-					track = 50;
-					setGreen(trkColor, 3);
-				}
-			}
-			else if (center.y <= 80)
+	// Follow an external MIDI clock, if there is one to follow
+	ClockSync clock;
+	RtMidiIn* midiin = 0;
+	if (config.clockInput >= 0)
+	{
+		try {
+			midiin = new RtMidiIn(midiout->getCurrentApi());
+			midiin->openPort(config.clockInput);
+			std::cout << "Following MIDI clock from " << midiin->getPortName(config.clockInput) << std::endl;
+			clock.attach(midiin);
+		}
+		catch (RtMidiError& error) {
+			error.printMessage();
+		}
+	}
+
+	ClockGenerator tempo(midi, config.tempo);
+	tempo.start();
+	Sequencer sequencer(layout, midi, tempo, config.sequencer);
+	sequencer.start();
+
+	// Keep the camera frames for the bench's replay mode, if asked to
+	if (!config.record.path.empty())
+	{
+		capture.record(config.record);
+	}
+
+	FramePipeline pipeline(capture, classifier, layout, midi, clock, tempo, sequencer, latency, config);
+	pipeline.start();
+
+	FrameContext frame;
+	cv::Mat image, converted, mask;
+	int marker = 0;
+
+	while (true)
+	{
+		// Trackbars can only be read from the UI thread
+		if (colours.size() > 1)
+		{
+			int selected = cv::getTrackbarPos("Marker", "Set HSV");
+			if (selected != marker)
 			{
-				if ((80 <= center.x) && (center.x <= 160))
-				{
-					setGreen(patColor, 0);
-					if (hasPlayed == false)
-					{
-						hasPlayed = true;
-						playNote(midiout, track + 1);
-					}
-				}
-				else if ((175 <= center.x) && (center.x <= 255))
-				{
-					setGreen(patColor, 1);
-					if (hasPlayed == false)
-					{
-						hasPlayed = true;
-						playNote(midiout, track + 2);
-					}
-				}
-				else if ((270 <= center.x) && (center.x <= 350))
-				{
-					setGreen(patColor, 2);
-					if (hasPlayed == false)
-					{
-						hasPlayed = true;
-						playNote(midiout, track + 3);
-					}
-				}
-				else if ((365 <= center.x) && (center.x <= 445))
-				{
-					setGreen(patColor, 3);
-					if (hasPlayed == false)
-					{
-						hasPlayed = true;
-						playNote(midiout, track + 4);
-					}
-				}
-				else if ((460 <= center.x) && (center.x <= 540))
-				{
-					setGreen(patColor, 4, true);
-					if (hasPlayed == false)
-					{
-						hasPlayed = true;
-						playNote(midiout, track + 9);
-					}
-				}
+				// Show the thresholds of the newly selected marker colour
+				marker = selected;
+				HsvBounds bounds = classifier.bounds(marker);
+				cv::setTrackbarPos("Upper Hue", "Set HSV", bounds.upper[0]);
+				cv::setTrackbarPos("Upper Saturation", "Set HSV", bounds.upper[1]);
+				cv::setTrackbarPos("Upper Value", "Set HSV", bounds.upper[2]);
+				cv::setTrackbarPos("Lower Hue", "Set HSV", bounds.lower[0]);
+				cv::setTrackbarPos("Lower Saturation", "Set HSV", bounds.lower[1]);
+				cv::setTrackbarPos("Lower Value", "Set HSV", bounds.lower[2]);
 			}
-			else
+		}
+
+		HsvBounds bounds;
+		bounds.upper[0] = cv::saturate_cast<uchar>(cv::getTrackbarPos("Upper Hue", "Set HSV"));
+		bounds.upper[1] = cv::saturate_cast<uchar>(cv::getTrackbarPos("Upper Saturation", "Set HSV"));
+		bounds.upper[2] = cv::saturate_cast<uchar>(cv::getTrackbarPos("Upper Value", "Set HSV"));
+		bounds.lower[0] = cv::saturate_cast<uchar>(cv::getTrackbarPos("Lower Hue", "Set HSV"));
+		bounds.lower[1] = cv::saturate_cast<uchar>(cv::getTrackbarPos("Lower Saturation", "Set HSV"));
+		bounds.lower[2] = cv::saturate_cast<uchar>(cv::getTrackbarPos("Lower Value", "Set HSV"));
+
+		// Rebuilds the colour table in the background only if something moved
+		classifier.setBounds(marker, bounds);
+
+		if (!pipeline.nextFrame(frame))
+		{
+			if ((cv::waitKey(1) & 0xFF) == 'q')
 			{
-				hasPlayed = false;
+				break;
 			}
+			continue;
+		}
+
+		// Only frames that are shown become BGR
+		cv::flip(bgrImage(frame.image, frame.format, converted), image, 1);
+		// Tiles and their labels, redrawn only where a state changed
+		overlay.update(frame.zoneState);
+		overlay.composite(image);
+
+		for (const Track& track : frame.tracks)
+		{
+			cv::circle(image, track.position, int(track.radius), cv::Scalar(0, 255, 255), 2);
+			cv::putText(image, std::to_string(track.id), track.position, cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 255), 1, cv::LINE_AA);
 		}
 
 		// Display
+		frame.bits.toMat(mask);
 		imshow("Display Mask", mask);
 		imshow("Display Cam", image);
-		int key = (cv::waitKey(25) & 0xFF);
+		int key = (cv::waitKey(1) & 0xFF);
+		latency.record(LatencyStage::Displayed, frame.arrived);
 		// Press 'q' to quit
 		if (key == 'q')
 		{
 			break;
 		}
+		// Press 'l' for the latency report so far
+		if (key == 'l')
+		{
+			latency.print(std::cout);
+		}
 	}
 
-	cap.release();
+	pipeline.stop();
+	sequencer.stop();
+	tempo.stop();
+	clock.detach();
+	delete midiin;
+	midi.stop();
 	cv::destroyAllWindows();
 
+	pipeline.printStats(std::cout);
+	midi.printStats(std::cout);
+	sequencer.printStats(std::cout);
+	tempo.printStats(std::cout);
+	clock.printStats(std::cout);
+	latency.print(std::cout);
+
 	return 0;
 }
\ No newline at end of file
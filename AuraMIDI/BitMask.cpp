@@ -0,0 +1,263 @@
+#include "BitMask.h"
+
+#include <algorithm>
+
+#include "SimdSupport.h"
+
+BitMask::BitMask()
+	: width_(0), height_(0), stride_(0)
+{
+}
+
+void BitMask::create(int width, int height)
+{
+	width_ = width;
+	height_ = height;
+	stride_ = (width + 63) / 64;
+	words_.resize(static_cast<size_t>(stride_) * height);
+}
+
+static void packRow(const uchar* p, uint64_t* words, int width)
+{
+	int x = 0;
+#if defined(AURA_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 64 <= width; x += 64)
+	{
+		uint64_t word = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + x + 16 * k));
+			unsigned isZero = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+			word |= static_cast<uint64_t>(~isZero & 0xFFFF) << (16 * k);
+		}
+		words[x >> 6] = word;
+	}
+#endif
+	for (; x < width; x += 64)
+	{
+		uint64_t word = 0;
+		int count = std::min(64, width - x);
+		for (int i = 0; i < count; i++)
+		{
+			word |= static_cast<uint64_t>(p[x + i] != 0) << i;
+		}
+		words[x >> 6] = word;
+	}
+}
+
+void BitMask::fromMat(const cv::Mat& mask)
+{
+	CV_Assert(mask.type() == CV_8UC1);
+	create(mask.cols, mask.rows);
+	for (int y = 0; y < height_; y++)
+	{
+		packRow(mask.ptr<uchar>(y), row(y), width_);
+	}
+}
+
+void BitMask::toMat(cv::Mat& mask) const
+{
+	mask.create(height_, width_, CV_8UC1);
+	for (int y = 0; y < height_; y++)
+	{
+		const uint64_t* words = row(y);
+		uchar* p = mask.ptr<uchar>(y);
+		for (int x = 0; x < width_; x++)
+		{
+			p[x] = static_cast<uchar>(0 - ((words[x >> 6] >> (x & 63)) & 1));
+		}
+	}
+}
+
+// dst[x] = src[x + shift] over a row of bits; positions outside the row
+// read as the fill word.
+static void shiftBits(const uint64_t* src, uint64_t* dst, int words, int shift, uint64_t fill)
+{
+	int wordShift = shift >= 0 ? shift / 64 : -((63 - shift) / 64);
+	int bitShift = shift - wordShift * 64;
+
+	for (int i = 0; i < words; i++)
+	{
+		int j = i + wordShift;
+		uint64_t low = (j >= 0 && j < words) ? src[j] : fill;
+		if (bitShift == 0)
+		{
+			dst[i] = low;
+			continue;
+		}
+		uint64_t high = (j + 1 >= 0 && j + 1 < words) ? src[j + 1] : fill;
+		dst[i] = (low >> bitShift) | (high << (64 - bitShift));
+	}
+}
+
+template <bool Erode>
+static inline uint64_t combine(uint64_t a, uint64_t b)
+{
+	return Erode ? (a & b) : (a | b);
+}
+
+// acc[x] becomes the combination of acc[x], acc[x + step], ... over span
+// pixels (step is +1 or -1), by doubling the covered span each round.
+template <bool Erode>
+static void spanRow(uint64_t* acc, uint64_t* tmp, int words, int span, int step, uint64_t fill)
+{
+	int covered = 1;
+	while (covered * 2 <= span)
+	{
+		shiftBits(acc, tmp, words, covered * step, fill);
+		for (int i = 0; i < words; i++)
+		{
+			acc[i] = combine<Erode>(acc[i], tmp[i]);
+		}
+		covered *= 2;
+	}
+	if (covered < span)
+	{
+		// Overlapping the last round is harmless for and/or
+		shiftBits(acc, tmp, words, (span - covered) * step, fill);
+		for (int i = 0; i < words; i++)
+		{
+			acc[i] = combine<Erode>(acc[i], tmp[i]);
+		}
+	}
+}
+
+BinaryMorphology::BinaryMorphology(int erodeSize, int dilateSize)
+	: erodeSize_(std::max(1, erodeSize | 1)), dilateSize_(std::max(1, dilateSize | 1))
+{
+}
+
+template <bool Erode>
+void BinaryMorphology::rows(const BitMask& src, BitMask& dst, int size)
+{
+	const int words = src.wordsPerRow();
+	const int radius = size / 2;
+	const uint64_t fill = Erode ? ~0ull : 0ull;
+	const int tailBits = src.width() & 63;
+	const uint64_t tailMask = tailBits ? (1ull << tailBits) - 1 : ~0ull;
+
+	dst.create(src.width(), src.height());
+	rowA_.resize(words);
+	rowB_.resize(words);
+	rowC_.resize(words);
+
+	for (int y = 0; y < src.height(); y++)
+	{
+		// Bits past the width are outside the image and must stay neutral
+		std::copy(src.row(y), src.row(y) + words, rowA_.begin());
+		if (Erode && words > 0)
+		{
+			rowA_[words - 1] |= ~tailMask;
+		}
+
+		// Window [x - radius, x + radius] = forward span & backward span
+		std::copy(rowA_.begin(), rowA_.end(), rowB_.begin());
+		spanRow<Erode>(rowB_.data(), rowC_.data(), words, radius + 1, 1, fill);
+		spanRow<Erode>(rowA_.data(), rowC_.data(), words, radius + 1, -1, fill);
+
+		uint64_t* out = dst.row(y);
+		for (int i = 0; i < words; i++)
+		{
+			out[i] = combine<Erode>(rowA_[i], rowB_[i]);
+		}
+		if (words > 0)
+		{
+			out[words - 1] &= tailMask;
+		}
+	}
+}
+
+template <bool Erode>
+void BinaryMorphology::columns(const BitMask& src, BitMask& dst, int size)
+{
+	const int words = src.wordsPerRow();
+	const int height = src.height();
+	const int radius = size / 2;
+	const int extended = height + 2 * radius;
+	const uint64_t fill = Erode ? ~0ull : 0ull;
+
+	// Rows of the image padded with radius neutral rows above and below,
+	// split into blocks of size rows. prefix_ runs forward from each block
+	// start and suffix_ backward from each block end, so any window of
+	// size rows is one suffix combined with one prefix.
+	prefix_.resize(static_cast<size_t>(extended) * words);
+	suffix_.resize(static_cast<size_t>(extended) * words);
+
+	auto source = [&](int e, int i) -> uint64_t {
+		int y = e - radius;
+		return (y >= 0 && y < height) ? src.row(y)[i] : fill;
+	};
+
+	for (int e = 0; e < extended; e++)
+	{
+		uint64_t* p = prefix_.data() + static_cast<size_t>(e) * words;
+		if (e % size == 0)
+		{
+			for (int i = 0; i < words; i++)
+			{
+				p[i] = source(e, i);
+			}
+		}
+		else
+		{
+			const uint64_t* previous = p - words;
+			for (int i = 0; i < words; i++)
+			{
+				p[i] = combine<Erode>(previous[i], source(e, i));
+			}
+		}
+	}
+
+	for (int e = extended - 1; e >= 0; e--)
+	{
+		uint64_t* s = suffix_.data() + static_cast<size_t>(e) * words;
+		if (e % size == size - 1 || e == extended - 1)
+		{
+			for (int i = 0; i < words; i++)
+			{
+				s[i] = source(e, i);
+			}
+		}
+		else
+		{
+			const uint64_t* next = s + words;
+			for (int i = 0; i < words; i++)
+			{
+				s[i] = combine<Erode>(next[i], source(e, i));
+			}
+		}
+	}
+
+	// Everything needed now lives in prefix_/suffix_, so dst may alias src
+	dst.create(src.width(), height);
+	for (int y = 0; y < height; y++)
+	{
+		const uint64_t* s = suffix_.data() + static_cast<size_t>(y) * words;
+		const uint64_t* p = prefix_.data() + static_cast<size_t>(y + 2 * radius) * words;
+		uint64_t* out = dst.row(y);
+		for (int i = 0; i < words; i++)
+		{
+			out[i] = combine<Erode>(s[i], p[i]);
+		}
+	}
+}
+
+void BinaryMorphology::erode(const BitMask& src, BitMask& dst, int size)
+{
+	rows<true>(src, dst, size);
+	columns<true>(dst, dst, size);
+}
+
+void BinaryMorphology::dilate(const BitMask& src, BitMask& dst, int size)
+{
+	rows<false>(src, dst, size);
+	columns<false>(dst, dst, size);
+}
+
+void BinaryMorphology::apply(const cv::Mat& source, BitMask& mask)
+{
+	packed_.fromMat(source);
+	erode(packed_, pass_, erodeSize_);
+	dilate(pass_, mask, dilateSize_);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+// Binary image with one bit per pixel. Pixel x of a row lives in bit
+// (x % 64) of word (x / 64); bits past the width are always zero.
+class BitMask
+{
+public:
+	BitMask();
+
+	void create(int width, int height);
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	int wordsPerRow() const { return stride_; }
+
+	uint64_t* row(int y) { return words_.data() + static_cast<size_t>(y) * stride_; }
+	const uint64_t* row(int y) const { return words_.data() + static_cast<size_t>(y) * stride_; }
+
+	bool get(int x, int y) const { return (row(y)[x >> 6] >> (x & 63)) & 1; }
+
+	// Any non-zero byte of an 8-bit image becomes a set bit.
+	void fromMat(const cv::Mat& mask);
+	// Expands back to an 8-bit 0/255 image.
+	void toMat(cv::Mat& mask) const;
+
+private:
+	int width_;
+	int height_;
+	int stride_;
+	std::vector<uint64_t> words_;
+};
+
+// Rectangular erosion and dilation on packed masks. Both are separable:
+// rows use shift-and/or doubling (log2 of the kernel width word operations
+// per 64 pixels) and columns use the van Herk/Gil-Werman block scheme (three
+// word operations per 64 pixels whatever the kernel height). Pixels outside
+// the image never erode or dilate anything, matching OpenCV's default border.
+class BinaryMorphology
+{
+public:
+	// erodeSize x erodeSize erosion followed by dilateSize x dilateSize
+	// dilation; sizes are rounded up to odd numbers.
+	BinaryMorphology(int erodeSize, int dilateSize);
+
+	// The whole noise-suppression chain as one operation: packs the
+	// non-zero pixels of an 8-bit image, erodes, then dilates.
+	void apply(const cv::Mat& source, BitMask& mask);
+
+	void erode(const BitMask& src, BitMask& dst, int size);
+	void dilate(const BitMask& src, BitMask& dst, int size);
+
+	int erodeSize() const { return erodeSize_; }
+	int dilateSize() const { return dilateSize_; }
+
+private:
+	template <bool Erode>
+	void rows(const BitMask& src, BitMask& dst, int size);
+	template <bool Erode>
+	void columns(const BitMask& src, BitMask& dst, int size);
+
+	int erodeSize_;
+	int dilateSize_;
+
+	// Scratch space, reused across frames
+	BitMask packed_;
+	BitMask pass_;
+	std::vector<uint64_t> prefix_;
+	std::vector<uint64_t> suffix_;
+	std::vector<uint64_t> rowA_;
+	std::vector<uint64_t> rowB_;
+	std::vector<uint64_t> rowC_;
+};
@@ -0,0 +1,183 @@
+#include "BlobExtractor.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "SimdSupport.h"
+
+// Sum of x^2 for x = 0..n
+static inline double sumOfSquares(double n)
+{
+	return n * (n + 1) * (2 * n + 1) / 6;
+}
+
+BlobExtractor::BlobExtractor(int minArea)
+	: minArea_(minArea)
+{
+}
+
+void BlobExtractor::setMinArea(int minArea)
+{
+	minArea_ = minArea;
+}
+
+const std::vector<Blob>& BlobExtractor::blobs() const
+{
+	return blobs_;
+}
+
+int BlobExtractor::find(int run)
+{
+	while (parent_[run] != run)
+	{
+		parent_[run] = parent_[parent_[run]];
+		run = parent_[run];
+	}
+	return run;
+}
+
+void BlobExtractor::join(int a, int b)
+{
+	a = find(a);
+	b = find(b);
+	if (a < b)
+	{
+		parent_[b] = a;
+	}
+	else if (b < a)
+	{
+		parent_[a] = b;
+	}
+}
+
+const std::vector<Blob>& BlobExtractor::extract(const BitMask& mask, const cv::Mat& labels)
+{
+	const int words = mask.wordsPerRow();
+	const bool hasLabels = !labels.empty();
+	runs_.clear();
+	parent_.clear();
+
+	int previousStart = 0;
+	int previousEnd = 0;
+	for (int y = 0; y < mask.height(); y++)
+	{
+		const uint64_t* row = mask.row(y);
+		const uchar* classes = hasLabels ? labels.ptr<uchar>(y) : nullptr;
+		const int currentStart = static_cast<int>(runs_.size());
+
+		// Cut the row into runs, skipping whole empty words at a time
+		int i = 0;
+		uint64_t remaining = words > 0 ? row[0] : 0;
+		while (i < words)
+		{
+			if (remaining == 0)
+			{
+				if (++i < words)
+				{
+					remaining = row[i];
+				}
+				continue;
+			}
+
+			int x0 = i * 64 + countTrailingZeros(remaining);
+			uint64_t clear = ~remaining & (~0ull << (x0 & 63));
+			while (clear == 0 && ++i < words)
+			{
+				remaining = row[i];
+				clear = ~remaining;
+			}
+			int x1 = i < words ? i * 64 + countTrailingZeros(clear) : words * 64;
+			if (i < words)
+			{
+				remaining &= ~0ull << (x1 & 63);
+			}
+
+			Run run = { y, x0, x1, classes ? classes[(x0 + x1 - 1) / 2] : 0 };
+			parent_.push_back(static_cast<int>(runs_.size()));
+			runs_.push_back(run);
+		}
+		const int currentEnd = static_cast<int>(runs_.size());
+
+		// Join runs touching the previous row, diagonals included
+		int a = previousStart;
+		int b = currentStart;
+		while (a < previousEnd && b < currentEnd)
+		{
+			if (runs_[a].x0 <= runs_[b].x1 && runs_[b].x0 <= runs_[a].x1)
+			{
+				join(a, b);
+			}
+			if (runs_[a].x1 < runs_[b].x1)
+			{
+				a++;
+			}
+			else
+			{
+				b++;
+			}
+		}
+
+		previousStart = currentStart;
+		previousEnd = currentEnd;
+	}
+
+	// Fold every run into the moments of its root
+	blobOfRoot_.assign(runs_.size(), -1);
+	moments_.clear();
+	for (int r = 0; r < static_cast<int>(runs_.size()); r++)
+	{
+		const Run& run = runs_[r];
+		int root = find(r);
+		if (blobOfRoot_[root] < 0)
+		{
+			blobOfRoot_[root] = static_cast<int>(moments_.size());
+			Moments empty = { 0, 0, 0, 0, 0, 0, run.x0, run.y, run.x1 - 1, run.y, 0, 0 };
+			moments_.push_back(empty);
+		}
+		Moments& m = moments_[blobOfRoot_[root]];
+
+		double n = run.x1 - run.x0;
+		double y = run.y;
+		double sx = n * (run.x0 + run.x1 - 1) / 2;
+		m.area += n;
+		m.sx += sx;
+		m.sy += n * y;
+		m.sxx += sumOfSquares(run.x1 - 1) - sumOfSquares(run.x0 - 1);
+		m.syy += n * y * y;
+		m.sxy += y * sx;
+		m.minX = std::min(m.minX, run.x0);
+		m.maxX = std::max(m.maxX, run.x1 - 1);
+		m.minY = std::min(m.minY, run.y);
+		m.maxY = std::max(m.maxY, run.y);
+		if (run.classId != 0 && run.x1 - run.x0 > m.classRun)
+		{
+			m.classId = run.classId;
+			m.classRun = run.x1 - run.x0;
+		}
+	}
+
+	blobs_.clear();
+	for (const Moments& m : moments_)
+	{
+		if (m.area < minArea_)
+		{
+			continue;
+		}
+
+		Blob blob;
+		blob.area = static_cast<int>(m.area);
+		blob.bounds = cv::Rect(m.minX, m.minY, m.maxX - m.minX + 1, m.maxY - m.minY + 1);
+		double cx = m.sx / m.area;
+		double cy = m.sy / m.area;
+		blob.centroid = cv::Point2f(static_cast<float>(cx), static_cast<float>(cy));
+		blob.mu20 = static_cast<float>(m.sxx / m.area - cx * cx);
+		blob.mu02 = static_cast<float>(m.syy / m.area - cy * cy);
+		blob.mu11 = static_cast<float>(m.sxy / m.area - cx * cy);
+		blob.radius = static_cast<float>(std::sqrt(m.area / CV_PI));
+		blob.classId = m.classId;
+		blobs_.push_back(blob);
+	}
+
+	std::sort(blobs_.begin(), blobs_.end(), [](const Blob& a, const Blob& b) { return a.area > b.area; });
+	return blobs_;
+}
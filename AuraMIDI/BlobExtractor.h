@@ -0,0 +1,70 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "BitMask.h"
+
+// One 8-connected region of a mask.
+struct Blob
+{
+	int area = 0;
+	cv::Rect bounds;
+	cv::Point2f centroid;
+	// Central second moments (variance of x, of y, and covariance)
+	float mu20 = 0;
+	float mu02 = 0;
+	float mu11 = 0;
+	// Radius of the disc with the same area
+	float radius = 0;
+	// Marker class (see ColourClassifier) covering most of the blob, 0 if unknown
+	int classId = 0;
+};
+
+// Single-pass connected-component labeller working on runs instead of
+// pixels. Each row of the packed mask is cut into runs of set bits, runs
+// touching a run of the previous row are joined with union-find, and area,
+// bounding box and moments are accumulated per run rather than per pixel.
+// Buffers are kept between frames, so steady-state extraction does not
+// allocate.
+class BlobExtractor
+{
+public:
+	explicit BlobExtractor(int minArea);
+
+	void setMinArea(int minArea);
+
+	// Extracts every blob of at least minArea pixels, largest first.
+	// labels (optional, CV_8U) supplies the marker class of each blob.
+	const std::vector<Blob>& extract(const BitMask& mask, const cv::Mat& labels = cv::Mat());
+
+	const std::vector<Blob>& blobs() const;
+
+private:
+	struct Run
+	{
+		int y;
+		int x0; // First pixel
+		int x1; // One past the last pixel
+		int classId;
+	};
+
+	struct Moments
+	{
+		double area;
+		double sx, sy, sxx, syy, sxy;
+		int minX, minY, maxX, maxY;
+		int classId;
+		int classRun; // Length of the run that set classId
+	};
+
+	int find(int run);
+	void join(int a, int b);
+
+	int minArea_;
+	std::vector<Run> runs_;
+	std::vector<int> parent_;
+	std::vector<int> blobOfRoot_;
+	std::vector<Moments> moments_;
+	std::vector<Blob> blobs_;
+};
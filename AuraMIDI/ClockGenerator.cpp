@@ -0,0 +1,264 @@
+#include "ClockGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <string>
+#ifdef __linux__
+#include <cerrno>
+#include <time.h>
+#endif
+
+#include "ThreadPriority.h"
+
+// Taps further apart than this start a new count; closer ones are bounces
+static const double slowestTap = 2.0;
+static const double fastestTap = 0.25;
+// Taps waiting for the clock thread at most
+static const size_t tapCapacity = 16;
+// Time from start() to the first clock, on top of the engine's lead
+static const std::chrono::milliseconds startDelay(10);
+
+TempoConfig TempoConfig::fromJson(const Json::Value& value)
+{
+	TempoConfig config;
+	if (!value.isObject())
+	{
+		return config;
+	}
+	config.bpm = std::min(300.0f, std::max(20.0f, value.get("bpm", config.bpm).asFloat()));
+	config.rampBeats = std::max(0.0f, value.get("rampBeats", config.rampBeats).asFloat());
+	config.sendClock = value.get("sendClock", config.sendClock).asBool();
+	config.realtime = value.get("realtime", config.realtime).asBool();
+	return config;
+}
+
+// Sleeps until at, however long that takes. Against an absolute deadline
+// on Linux, so time spent before the call is never slept on top.
+static void sleepUntil(std::chrono::steady_clock::time_point at)
+{
+#ifdef __linux__
+	// steady_clock is CLOCK_MONOTONIC here
+	const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(at.time_since_epoch()).count();
+	timespec deadline;
+	deadline.tv_sec = static_cast<time_t>(ns / 1000000000);
+	deadline.tv_nsec = static_cast<long>(ns % 1000000000);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR)
+	{
+	}
+#else
+	std::this_thread::sleep_until(at);
+#endif
+}
+
+ClockGenerator::ClockGenerator(MidiEngine& midi, const TempoConfig& config)
+	: midi_(midi), config_(config), taps_(tapCapacity, OverflowPolicy::DropOldest), running_(false), realtime_(false),
+	tick_(0), tickAt_(0), bpm_(config.bpm), targetBpm_(config.bpm), rampTicks_(0), tapCount_(-1), lastTarget_(0),
+	clocks_(0), tempo_(config.bpm), worstUs_(0)
+{
+	for (std::atomic<uint64_t>& bucket : histogram_)
+	{
+		bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+ClockGenerator::~ClockGenerator()
+{
+	stop();
+}
+
+void ClockGenerator::start()
+{
+	if (running_)
+	{
+		return;
+	}
+	epoch_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(midi_.leadMs()) + startDelay;
+	tick_ = 0;
+	tickAt_ = 0;
+	running_ = true;
+	thread_ = std::thread(&ClockGenerator::run, this);
+	realtime_ = config_.realtime && raiseThreadPriority(thread_);
+}
+
+void ClockGenerator::stop()
+{
+	if (!running_)
+	{
+		return;
+	}
+	running_ = false;
+	if (thread_.joinable())
+	{
+		thread_.join();
+	}
+	// The clock thread is gone, so this thread may use its queue now
+	if (config_.sendClock)
+	{
+		send(0xFC, std::chrono::steady_clock::now());
+	}
+}
+
+void ClockGenerator::tap(std::chrono::steady_clock::time_point time)
+{
+	taps_.push(std::move(time), running_);
+}
+
+const ClockState& ClockGenerator::timeline()
+{
+	shared_.acquire();
+	return shared_.readBuffer();
+}
+
+void ClockGenerator::printStats(std::ostream& out) const
+{
+	uint64_t clocks = clocks_.load(std::memory_order_relaxed);
+	if (clocks < 2)
+	{
+		return;
+	}
+	out << (config_.sendClock ? "MIDI clock out: " : "Tempo clock: ") << clocks << " clocks, "
+		<< tempo_.load(std::memory_order_relaxed) << " BPM, worst wake-up error "
+		<< worstUs_.load(std::memory_order_relaxed) << " us" << (realtime_ ? "" : " (no real-time priority)") << std::endl;
+
+	uint64_t peak = 0;
+	for (const std::atomic<uint64_t>& bucket : histogram_)
+	{
+		peak = std::max(peak, bucket.load(std::memory_order_relaxed));
+	}
+	// Time between wake-ups minus the time between their deadlines
+	for (int i = 0; i < bucketCount; i++)
+	{
+		uint64_t count = histogram_[i].load(std::memory_order_relaxed);
+		if (count == 0)
+		{
+			continue;
+		}
+		const int from = (i - 1) * bucketUs - 1000;
+		out << "  ";
+		if (i == 0)
+		{
+			out << std::setw(16) << "< -1000 us";
+		}
+		else if (i == bucketCount - 1)
+		{
+			out << std::setw(16) << ">= 1000 us";
+		}
+		else
+		{
+			out << std::setw(6) << from << " .. " << std::setw(5) << from + bucketUs << " us";
+		}
+		out << std::setw(9) << count << " " << std::string(static_cast<size_t>((count * 50 + peak - 1) / peak), '#') << std::endl;
+	}
+}
+
+ClockGenerator::TimePoint ClockGenerator::timeOf(double seconds) const
+{
+	return epoch_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+void ClockGenerator::run()
+{
+	// With driver scheduling each clock goes over early, stamped with when
+	// it is due; without, it goes the moment it is due
+	const double lead = midi_.leadMs() / 1000.0;
+	if (config_.sendClock)
+	{
+		send(0xFA, epoch_);
+	}
+
+	while (running_)
+	{
+		takeTaps();
+
+		ClockState& state = shared_.writeBuffer();
+		state.running = true;
+		state.locked = true;
+		state.tick = tick_;
+		state.tickTime = timeOf(tickAt_);
+		state.tickSeconds = 60.0 / (bpm_ * 24);
+		shared_.publish();
+
+		const double target = tickAt_ - lead;
+		sleepUntil(timeOf(target));
+		measure(std::chrono::steady_clock::now(), target);
+
+		if (config_.sendClock)
+		{
+			send(0xF8, timeOf(tickAt_));
+		}
+		clocks_.fetch_add(1, std::memory_order_relaxed);
+
+		// The ramp moves the tempo a little every clock
+		if (rampTicks_ > 0)
+		{
+			bpm_ += (targetBpm_ - bpm_) / rampTicks_;
+			rampTicks_--;
+			tempo_.store(bpm_, std::memory_order_relaxed);
+		}
+		tickAt_ += 60.0 / (bpm_ * 24);
+		tick_++;
+	}
+}
+
+void ClockGenerator::takeTaps()
+{
+	TimePoint tap;
+	while (taps_.tryPop(tap))
+	{
+		const double interval = std::chrono::duration<double>(tap - lastTap_).count();
+		lastTap_ = tap;
+		if (tapCount_ < 0 || interval > slowestTap || interval < fastestTap)
+		{
+			tapCount_ = 0;
+			continue;
+		}
+		tapIntervals_[tapCount_ % tapHistory] = interval;
+		tapCount_++;
+
+		const int count = std::min(tapCount_, tapHistory);
+		double sum = 0;
+		for (int i = 0; i < count; i++)
+		{
+			sum += tapIntervals_[i];
+		}
+		setTempo(60.0 * count / sum);
+	}
+}
+
+void ClockGenerator::setTempo(double bpm)
+{
+	targetBpm_ = bpm;
+	rampTicks_ = static_cast<int>(std::lround(config_.rampBeats * 24));
+	if (rampTicks_ == 0)
+	{
+		bpm_ = bpm;
+		tempo_.store(bpm_, std::memory_order_relaxed);
+	}
+}
+
+void ClockGenerator::send(unsigned char status, TimePoint at)
+{
+	MidiEvent event;
+	event.message[0] = status;
+	event.size = 1;
+	midi_.sendAt(TimedSource::Clock, event, at);
+}
+
+void ClockGenerator::measure(TimePoint woke, double target)
+{
+	if (clocks_.load(std::memory_order_relaxed) > 0)
+	{
+		const double actual = std::chrono::duration<double>(woke - lastWake_).count();
+		const int64_t errorUs = std::llround((actual - (target - lastTarget_)) * 1e6);
+		int bucket = static_cast<int>(std::floor((errorUs + 1000.0) / bucketUs)) + 1;
+		bucket = std::min(bucketCount - 1, std::max(0, bucket));
+		histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+		if (std::llabs(errorUs) > worstUs_.load(std::memory_order_relaxed))
+		{
+			worstUs_.store(std::llabs(errorUs), std::memory_order_relaxed);
+		}
+	}
+	lastWake_ = woke;
+	lastTarget_ = target;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+
+#include "ClockSync.h"
+#include "MidiEngine.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+
+struct TempoConfig
+{
+	float bpm = 120;
+	float rampBeats = 2;   // A new tempo is reached over this many beats
+	bool sendClock = false; // Send MIDI clock, Start and Stop
+	bool realtime = true;  // Run the clock thread at real-time priority
+
+	// Reads the optional "tempo" object of the "pipeline" settings, e.g.
+	// "tempo": { "bpm": 120, "rampBeats": 2, "sendClock": true, "realtime": true }
+	static TempoConfig fromJson(const Json::Value& value);
+};
+
+// Master tempo of the program: a dedicated thread that counts MIDI clocks
+// (24 per quarter note) against absolute deadlines, so sleeping late never
+// shifts the clocks after it. The pattern sequencer follows its timeline,
+// and with sendClock on it also sends MIDI clock so external sequencers
+// follow along. Where the port can schedule, each clock is handed over
+// ahead of time with its exact due time and the driver delivers it on the
+// dot; elsewhere it is sent as its deadline passes.
+//
+// Tempo comes from the settings or from tapping a tempo tile, and changes
+// glide over rampBeats. The time between clock thread wake-ups is
+// measured against the ideal and printed as a histogram.
+class ClockGenerator
+{
+public:
+	ClockGenerator(MidiEngine& midi, const TempoConfig& config);
+	~ClockGenerator();
+
+	ClockGenerator(const ClockGenerator&) = delete;
+	ClockGenerator& operator=(const ClockGenerator&) = delete;
+
+	// Start after the MIDI engine and stop before it.
+	void start();
+	void stop();
+
+	// Producer side, for a single thread: a tap on the tempo tile at time.
+	// Two or more taps in a row set the tempo.
+	void tap(std::chrono::steady_clock::time_point time);
+
+	// Where clocks fall: tick is the clock count since start. Running once
+	// started. For a single reading thread.
+	const ClockState& timeline();
+
+	void printStats(std::ostream& out) const;
+
+private:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	// Wake-up error histogram: 50 us buckets from -1 ms to +1 ms, plus one
+	// each side for everything further out
+	static const int bucketUs = 50;
+	static const int bucketCount = 2 * 1000 / bucketUs + 2;
+	static const int tapHistory = 4;
+
+	void run();
+	void takeTaps();
+	void setTempo(double bpm);
+	void send(unsigned char status, TimePoint at);
+	TimePoint timeOf(double seconds) const;
+	void measure(TimePoint woke, double target);
+
+	MidiEngine& midi_;
+	TempoConfig config_;
+	SpscQueue<TimePoint> taps_;
+	TripleBuffer<ClockState> shared_;
+
+	std::atomic<bool> running_;
+	std::thread thread_;
+	bool realtime_; // Got real-time priority
+
+	// Clock thread only
+	TimePoint epoch_;        // When clock 0 is due
+	int64_t tick_;           // Next clock
+	double tickAt_;          // When it is due, in seconds from epoch_
+	double bpm_;
+	double targetBpm_;
+	int rampTicks_;          // Clocks left until targetBpm_
+	TimePoint lastTap_;
+	double tapIntervals_[tapHistory];
+	int tapCount_;           // Intervals in a row so far
+	TimePoint lastWake_;
+	double lastTarget_;      // When the last wake-up was meant to be, in seconds from epoch_
+
+	std::atomic<uint64_t> clocks_;
+	std::atomic<double> tempo_; // Reached so far, in beats per minute
+	std::atomic<uint64_t> histogram_[bucketCount];
+	std::atomic<int64_t> worstUs_; // Largest wake-up error
+};
@@ -0,0 +1,186 @@
+#include "ClockSync.h"
+
+#include <cmath>
+
+// Loop gains: how much of each clock's timing error goes into the phase
+// and into the period. About critically damped, settling within a beat
+// or two of a tempo change while averaging out USB jitter.
+static const double phaseGain = 0.2;
+static const double periodGain = 0.02;
+// Clocks this far off the prediction (in periods) mean a jump, not jitter
+static const double relockError = 0.5;
+// Without a clock for this many periods the clock counts as gone
+static const double quietPeriods = 24;
+// A hit this far past a grid point (in grid steps) plays at once instead
+// of waiting almost a whole step
+static const double lateTolerance = 0.125;
+
+bool ClockState::nextGridPoint(TimePoint time, int gridTicks, TimePoint& at) const
+{
+	if (!running || !locked || tickSeconds <= 0 || gridTicks <= 0)
+	{
+		return false;
+	}
+	const double ticksSince = std::chrono::duration<double>(time - tickTime).count() / tickSeconds;
+	if (ticksSince > quietPeriods)
+	{
+		return false;
+	}
+
+	const double position = tick + ticksSince;
+	const double steps = position / gridTicks;
+	double next = std::ceil(steps);
+	if (steps - std::floor(steps) < lateTolerance)
+	{
+		next = std::floor(steps);
+	}
+	const double seconds = (next * gridTicks - tick) * tickSeconds;
+	at = tickTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+	return true;
+}
+
+ClockSync::ClockSync()
+	: midiin_(nullptr), running_(false), position_(-1), haveLast_(false), locked_(false), period_(0), squaredError_(0),
+	clocks_(0), relocks_(0), jitter_(0), tempo_(0)
+{
+}
+
+ClockSync::~ClockSync()
+{
+	detach();
+}
+
+void ClockSync::attach(RtMidiIn* midiin)
+{
+	detach();
+	midiin_ = midiin;
+	// Clock messages are timing messages, which RtMidiIn drops by default
+	midiin_->ignoreTypes(true, false, true);
+	midiin_->setCallback(&ClockSync::onMessage, this);
+}
+
+void ClockSync::detach()
+{
+	if (midiin_)
+	{
+		midiin_->cancelCallback();
+		midiin_ = nullptr;
+	}
+}
+
+const ClockState& ClockSync::state()
+{
+	shared_.acquire();
+	return shared_.readBuffer();
+}
+
+void ClockSync::printStats(std::ostream& out) const
+{
+	uint64_t clocks = clocks_.load(std::memory_order_relaxed);
+	if (clocks == 0)
+	{
+		return;
+	}
+	out << "MIDI clock: " << clocks << " clocks, " << tempo_.load(std::memory_order_relaxed) << " BPM, jitter "
+		<< jitter_.load(std::memory_order_relaxed) * 1000 << " ms RMS, relocked " << relocks_.load(std::memory_order_relaxed)
+		<< " times" << std::endl;
+}
+
+void ClockSync::onMessage(double, std::vector<unsigned char>* message, void* userData)
+{
+	// Arrival time rather than RtMidi's deltas: the loop filters the
+	// delivery jitter, and the estimate has to be in the clock the rest of
+	// the program uses
+	const TimePoint now = std::chrono::steady_clock::now();
+	if (message->empty())
+	{
+		return;
+	}
+	ClockSync& self = *static_cast<ClockSync*>(userData);
+	const std::vector<unsigned char>& bytes = *message;
+
+	switch (bytes[0])
+	{
+	case 0xF8: // Clock
+		self.clock(now);
+		return;
+	case 0xFA: // Start: the next clock is the first of the song
+		self.running_ = true;
+		self.position_ = -1;
+		break;
+	case 0xFB: // Continue from the last position
+		self.running_ = true;
+		break;
+	case 0xFC: // Stop
+		self.running_ = false;
+		break;
+	case 0xF2: // Song Position Pointer, in sixteenth notes
+		if (bytes.size() >= 3)
+		{
+			self.position_ = ((bytes[2] << 7 | bytes[1]) * 6) - 1;
+		}
+		break;
+	default:
+		return;
+	}
+	self.publish();
+}
+
+void ClockSync::clock(TimePoint now)
+{
+	clocks_.fetch_add(1, std::memory_order_relaxed);
+	if (running_)
+	{
+		position_++;
+	}
+
+	const double interval = haveLast_ ? std::chrono::duration<double>(now - last_).count() : 0;
+	const bool quiet = haveLast_ && locked_ && interval > quietPeriods * period_;
+	if (!haveLast_ || quiet)
+	{
+		// The first clock, or the first after a pause: nothing to go on yet
+		locked_ = false;
+	}
+	else if (!locked_)
+	{
+		period_ = interval;
+		phase_ = now;
+		locked_ = interval > 0;
+	}
+	else
+	{
+		const TimePoint predicted = phase_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(period_));
+		const double error = std::chrono::duration<double>(now - predicted).count();
+		if (std::fabs(error) > relockError * period_)
+		{
+			// Tempo jump: start again from the last interval
+			period_ = interval;
+			phase_ = now;
+			relocks_.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			phase_ = predicted + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(phaseGain * error));
+			period_ += periodGain * error;
+			squaredError_ += 0.01 * (error * error - squaredError_);
+			jitter_.store(std::sqrt(squaredError_), std::memory_order_relaxed);
+		}
+		tempo_.store(60.0 / (24 * period_), std::memory_order_relaxed);
+	}
+	haveLast_ = true;
+	last_ = now;
+	publish();
+}
+
+void ClockSync::publish()
+{
+	ClockState& state = shared_.writeBuffer();
+	state.running = running_;
+	state.locked = locked_;
+	state.tick = position_;
+	state.tickTime = phase_;
+	state.tickSeconds = period_;
+	shared_.publish();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <RtMidi.h>
+
+#include "TripleBuffer.h"
+
+// Tempo and song position of an external MIDI clock, as last estimated.
+struct ClockState
+{
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	bool running = false;   // Between Start or Continue and Stop
+	bool locked = false;    // Enough clocks seen to know the tempo
+	int64_t tick = 0;       // Song position in clocks (24 per quarter note) at tickTime
+	TimePoint tickTime;
+	double tickSeconds = 0; // Time between clocks
+
+	// When the first grid point (every gridTicks clocks from song start)
+	// at or after time comes; just after a grid point that is the one
+	// just passed. Returns false while the clock is stopped, not yet
+	// locked or has gone quiet.
+	bool nextGridPoint(TimePoint time, int gridTicks, TimePoint& at) const;
+};
+
+// Follows MIDI clock, Start, Continue, Stop and Song Position Pointer
+// from an RtMidiIn port. Everything runs in RtMidiIn's callback on the
+// MIDI input thread: a phase-locked loop (an alpha-beta filter on clock
+// arrival times) turns the jittery clocks into a steady tempo and phase,
+// and the result is published through a triple buffer, so whoever reads
+// it never shares a lock with the input thread.
+class ClockSync
+{
+public:
+	ClockSync();
+	~ClockSync();
+
+	ClockSync(const ClockSync&) = delete;
+	ClockSync& operator=(const ClockSync&) = delete;
+
+	// Starts listening on midiin, which must have a port open. The port
+	// stays the caller's; call detach() before closing it.
+	void attach(RtMidiIn* midiin);
+	void detach();
+
+	// The newest estimate. For a single reading thread.
+	const ClockState& state();
+
+	void printStats(std::ostream& out) const;
+
+private:
+	typedef ClockState::TimePoint TimePoint;
+
+	static void onMessage(double deltaSeconds, std::vector<unsigned char>* message, void* userData);
+	void clock(TimePoint now);
+	void publish();
+
+	RtMidiIn* midiin_;
+	TripleBuffer<ClockState> shared_;
+
+	// Input thread only
+	bool running_;
+	int64_t position_;   // Song position of the last clock
+	bool haveLast_;
+	TimePoint last_;     // When the last clock arrived
+	bool locked_;
+	TimePoint phase_;    // Filtered time of the last clock
+	double period_;      // Filtered time between clocks, in seconds
+	double squaredError_;
+
+	std::atomic<uint64_t> clocks_;
+	std::atomic<uint64_t> relocks_;
+	std::atomic<double> jitter_; // RMS phase error, in seconds
+	std::atomic<double> tempo_;  // Beats per minute
+};
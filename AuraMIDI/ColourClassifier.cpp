@@ -0,0 +1,371 @@
+#include "ColourClassifier.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "FrameCapture.h"
+#include "SimdSupport.h"
+
+static const int cellShift = 8 - ColourClassifier::channelBits;
+
+// Table cell holding the colour (b, g, r), or (y, u, v) in the YUV table.
+static inline int cellIndex(int b, int g, int r)
+{
+	return ((b >> cellShift) << (2 * ColourClassifier::channelBits))
+		| ((g >> cellShift) << ColourClassifier::channelBits)
+		| (r >> cellShift);
+}
+
+// BT.601 limited range YUV to BGR, in the same fixed point as cvtColor's
+// COLOR_YUV2BGR_YUYV and COLOR_YUV2BGR_NV12, so a camera's YUV pixel
+// falls in the class its converted BGR pixel would.
+static inline void yuvToBgr(int y, int u, int v, uchar* bgr)
+{
+	const int shift = 20;
+	const int half = 1 << (shift - 1);
+	const int luma = std::max(0, y - 16) * 1220542;
+	u -= 128;
+	v -= 128;
+	bgr[0] = cv::saturate_cast<uchar>((luma + half + 2116026 * u) >> shift);
+	bgr[1] = cv::saturate_cast<uchar>((luma + half - 852492 * v - 409993 * u) >> shift);
+	bgr[2] = cv::saturate_cast<uchar>((luma + half + 1673527 * v) >> shift);
+}
+
+std::vector<MarkerColour> loadMarkerColours(const Json::Value& data)
+{
+	std::vector<MarkerColour> colours;
+	for (const std::string& name : data.getMemberNames())
+	{
+		const Json::Value& entry = data[name];
+		if (!entry.isArray() || entry.size() != 6)
+		{
+			continue;
+		}
+
+		MarkerColour colour;
+		colour.name = name;
+		for (int i = 0; i < 3; i++)
+		{
+			colour.bounds.upper[i] = cv::saturate_cast<uchar>(entry[i].asInt());
+			colour.bounds.lower[i] = cv::saturate_cast<uchar>(entry[i + 3].asInt());
+		}
+		colours.push_back(colour);
+	}
+	return colours;
+}
+
+ColourClassifier::ColourClassifier(const std::vector<MarkerColour>& colours)
+	: colours_(colours), dirty_(false), running_(true)
+{
+	// The first table is built up front so that no frame goes unclassified
+	build(tables_.writeBuffer(), colours_);
+	tables_.publish();
+	builder_ = std::thread(&ColourClassifier::buildLoop, this);
+}
+
+ColourClassifier::~ColourClassifier()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		running_ = false;
+	}
+	wake_.notify_one();
+	builder_.join();
+}
+
+int ColourClassifier::classCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return static_cast<int>(colours_.size());
+}
+
+std::string ColourClassifier::name(int classIndex) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return colours_[classIndex].name;
+}
+
+HsvBounds ColourClassifier::bounds(int classIndex) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return colours_[classIndex].bounds;
+}
+
+void ColourClassifier::setBounds(int classIndex, const HsvBounds& bounds)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		HsvBounds& current = colours_[classIndex].bounds;
+		if (std::equal(bounds.lower, bounds.lower + 3, current.lower)
+			&& std::equal(bounds.upper, bounds.upper + 3, current.upper))
+		{
+			return;
+		}
+		current = bounds;
+		dirty_ = true;
+	}
+	wake_.notify_one();
+}
+
+void ColourClassifier::buildLoop()
+{
+	while (true)
+	{
+		std::vector<MarkerColour> colours;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait(lock, [this]() { return dirty_ || !running_; });
+			if (!running_)
+			{
+				return;
+			}
+			colours = colours_;
+			dirty_ = false;
+		}
+
+		// Trackbar drags arrive in bursts; anything that changes while this
+		// runs simply sets dirty_ again and triggers one more rebuild
+		build(tables_.writeBuffer(), colours);
+		tables_.publish();
+	}
+}
+
+// Fills a table over colours (c0, c1, c2), where toBgr gives the BGR
+// colour whose HSV the thresholds apply to.
+template <typename ToBgr>
+static void buildTable(uchar* table, const std::vector<MarkerColour>& colours, ToBgr toBgr)
+{
+	const int cellSize = 1 << (3 * cellShift);
+	const size_t classes = colours.size();
+
+	// votes[c * cellCount + cell]: how many of the cell's colours class c accepts
+	const int cellCount = ColourClassifier::cellCount;
+	std::vector<uchar> votes(classes * cellCount, 0);
+	std::vector<uchar> bgr(256 * 256 * 3);
+	std::vector<uchar> inside(256 * 256);
+
+	for (int c0 = 0; c0 < 256; c0++)
+	{
+		uchar* p = bgr.data();
+		for (int c1 = 0; c1 < 256; c1++)
+		{
+			for (int c2 = 0; c2 < 256; c2++, p += 3)
+			{
+				toBgr(c0, c1, c2, p);
+			}
+		}
+
+		for (size_t c = 0; c < classes; c++)
+		{
+			segmentHsvRow(bgr.data(), inside.data(), 256 * 256, colours[c].bounds);
+			uchar* classVotes = votes.data() + c * cellCount;
+			for (int i = 0; i < 256 * 256; i++)
+			{
+				classVotes[cellIndex(c0, i >> 8, i & 0xFF)] += inside[i] & 1;
+			}
+		}
+	}
+
+	// A cell belongs to the class accepting most of its colours, provided
+	// that is at least half of them; ties go to the earlier class
+	for (int cell = 0; cell < cellCount; cell++)
+	{
+		int best = 0;
+		int bestVotes = cellSize / 2 - 1;
+		for (size_t c = 0; c < classes; c++)
+		{
+			int count = votes[c * cellCount + cell];
+			if (count > bestVotes)
+			{
+				best = static_cast<int>(c) + 1;
+				bestVotes = count;
+			}
+		}
+		table[cell] = static_cast<uchar>(best);
+	}
+}
+
+void ColourClassifier::build(std::vector<uchar>& table, const std::vector<MarkerColour>& colours)
+{
+	// The BGR table, then the YUV one; three bytes of padding let the SIMD
+	// path gather 32 bits per cell
+	table.assign(2 * cellCount + 3, 0);
+	buildTable(table.data(), colours, [](int b, int g, int r, uchar* bgr) {
+		bgr[0] = static_cast<uchar>(b);
+		bgr[1] = static_cast<uchar>(g);
+		bgr[2] = static_cast<uchar>(r);
+	});
+	buildTable(table.data() + cellCount, colours, yuvToBgr);
+}
+
+static void classifyRowScalar(const uchar* bgr, uchar* labels, int width, const uchar* table)
+{
+	for (int x = 0; x < width; x++, bgr += 3)
+	{
+		labels[x] = table[cellIndex(bgr[0], bgr[1], bgr[2])];
+	}
+}
+
+// Y0 U Y1 V: both pixels of a pair share their chroma.
+static void classifyYuyvRowScalar(const uchar* yuyv, uchar* labels, int width, const uchar* table)
+{
+	for (int x = 0; x + 1 < width; x += 2, yuyv += 4)
+	{
+		labels[x] = table[cellIndex(yuyv[0], yuyv[1], yuyv[3])];
+		labels[x + 1] = table[cellIndex(yuyv[2], yuyv[1], yuyv[3])];
+	}
+}
+
+// One row of the Y plane, and the row of the UV plane below it holding
+// its chroma, one U V pair per two pixels.
+static void classifyNv12RowScalar(const uchar* luma, const uchar* chroma, uchar* labels, int width, const uchar* table)
+{
+	for (int x = 0; x < width; x++)
+	{
+		labels[x] = table[cellIndex(luma[x], chroma[x & ~1], chroma[x | 1])];
+	}
+}
+
+#if defined(AURA_X86)
+
+// Table entries for 16 pixels, from their three channels.
+AURA_TARGET_AVX2 static inline __m128i lookup16(__m128i c0, __m128i c1, __m128i c2, const uchar* table)
+{
+	const int* base = reinterpret_cast<const int*>(table);
+	const __m256i lowByte = _mm256_set1_epi32(0xFF);
+
+	__m256i cells[2];
+	for (int half = 0; half < 2; half++)
+	{
+		__m256i index = _mm256_or_si256(_mm256_or_si256(
+			_mm256_slli_epi32(_mm256_srli_epi32(_mm256_cvtepu8_epi32(c0), cellShift), 2 * ColourClassifier::channelBits),
+			_mm256_slli_epi32(_mm256_srli_epi32(_mm256_cvtepu8_epi32(c1), cellShift), ColourClassifier::channelBits)),
+			_mm256_srli_epi32(_mm256_cvtepu8_epi32(c2), cellShift));
+		cells[half] = _mm256_and_si256(_mm256_i32gather_epi32(base, index, 1), lowByte);
+
+		c0 = _mm_srli_si128(c0, 8);
+		c1 = _mm_srli_si128(c1, 8);
+		c2 = _mm_srli_si128(c2, 8);
+	}
+
+	__m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(cells[0], cells[1]), 0xD8);
+	return _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+}
+
+AURA_TARGET_AVX2 static void classifyRowAvx2(const uchar* bgr, uchar* labels, int width, const uchar* table)
+{
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i b, g, r;
+		deinterleaveBgr(bgr + 3 * x, b, g, r);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(labels + x), lookup16(b, g, r, table));
+	}
+
+	classifyRowScalar(bgr + 3 * x, labels + x, width - x, table);
+}
+
+AURA_TARGET_AVX2 static void classifyYuyvRowAvx2(const uchar* yuyv, uchar* labels, int width, const uchar* table)
+{
+	// Eight pixels per 16 bytes: their Y, and each pair's U and V twice
+	const __m128i lumaBytes = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i uBytes = _mm_setr_epi8(1, 1, 5, 5, 9, 9, 13, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i vBytes = _mm_setr_epi8(3, 3, 7, 7, 11, 11, 15, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(yuyv + 2 * x));
+		__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(yuyv + 2 * x + 16));
+		__m128i y = _mm_unpacklo_epi64(_mm_shuffle_epi8(lo, lumaBytes), _mm_shuffle_epi8(hi, lumaBytes));
+		__m128i u = _mm_unpacklo_epi64(_mm_shuffle_epi8(lo, uBytes), _mm_shuffle_epi8(hi, uBytes));
+		__m128i v = _mm_unpacklo_epi64(_mm_shuffle_epi8(lo, vBytes), _mm_shuffle_epi8(hi, vBytes));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(labels + x), lookup16(y, u, v, table));
+	}
+
+	classifyYuyvRowScalar(yuyv + 2 * x, labels + x, width - x, table);
+}
+
+AURA_TARGET_AVX2 static void classifyNv12RowAvx2(const uchar* luma, const uchar* chroma, uchar* labels, int width, const uchar* table)
+{
+	// 16 bytes of the UV plane are the chroma of 16 pixels
+	const __m128i uBytes = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14);
+	const __m128i vBytes = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15);
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(luma + x));
+		__m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(chroma + x));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(labels + x),
+			lookup16(y, _mm_shuffle_epi8(uv, uBytes), _mm_shuffle_epi8(uv, vBytes), table));
+	}
+
+	classifyNv12RowScalar(luma + x, chroma + x, labels + x, width - x, table);
+}
+
+#endif
+
+void ColourClassifier::classify(const cv::Mat& image, PixelFormat format, cv::Mat& labels)
+{
+	tables_.acquire();
+	const uchar* table = tables_.readBuffer().data();
+	const uchar* yuvTable = table + cellCount;
+
+	static const bool avx2 = detectSimdLevel() == SimdLevel::Avx2;
+	switch (format)
+	{
+	case PixelFormat::Yuyv:
+		CV_Assert(image.type() == CV_8UC2 && image.cols % 2 == 0);
+		labels.create(image.size(), CV_8UC1);
+		for (int y = 0; y < image.rows; y++)
+		{
+#if defined(AURA_X86)
+			if (avx2)
+			{
+				classifyYuyvRowAvx2(image.ptr<uchar>(y), labels.ptr<uchar>(y), image.cols, yuvTable);
+				continue;
+			}
+#endif
+			classifyYuyvRowScalar(image.ptr<uchar>(y), labels.ptr<uchar>(y), image.cols, yuvTable);
+		}
+		return;
+
+	case PixelFormat::Nv12:
+	{
+		// The Y plane, then the UV plane at half height
+		CV_Assert(image.type() == CV_8UC1 && image.rows % 3 == 0 && image.cols % 2 == 0);
+		const int height = image.rows * 2 / 3;
+		labels.create(height, image.cols, CV_8UC1);
+		for (int y = 0; y < height; y++)
+		{
+			const uchar* chroma = image.ptr<uchar>(height + y / 2);
+#if defined(AURA_X86)
+			if (avx2)
+			{
+				classifyNv12RowAvx2(image.ptr<uchar>(y), chroma, labels.ptr<uchar>(y), image.cols, yuvTable);
+				continue;
+			}
+#endif
+			classifyNv12RowScalar(image.ptr<uchar>(y), chroma, labels.ptr<uchar>(y), image.cols, yuvTable);
+		}
+		return;
+	}
+
+	default:
+		CV_Assert(image.type() == CV_8UC3);
+		labels.create(image.size(), CV_8UC1);
+		for (int y = 0; y < image.rows; y++)
+		{
+#if defined(AURA_X86)
+			if (avx2)
+			{
+				classifyRowAvx2(image.ptr<uchar>(y), labels.ptr<uchar>(y), image.cols, table);
+				continue;
+			}
+#endif
+			classifyRowScalar(image.ptr<uchar>(y), labels.ptr<uchar>(y), image.cols, table);
+		}
+		return;
+	}
+}
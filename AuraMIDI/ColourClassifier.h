@@ -0,0 +1,72 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <json/json.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Segmentation.h"
+#include "TripleBuffer.h"
+
+enum class PixelFormat;
+
+// A named marker colour, one per six-value entry in object.json.
+struct MarkerColour
+{
+	std::string name;
+	HsvBounds bounds;
+};
+
+// Reads every [upper H, S, V, lower H, S, V] array in object.json, e.g.
+// "highlighter": [69, 163, 255, 20, 59, 194]. Entries are returned in
+// name order, which is also their class order.
+std::vector<MarkerColour> loadMarkerColours(const Json::Value& data);
+
+// Labels every pixel of a frame with its marker class in one pass.
+// The HSV thresholds of all markers are compiled into quantised BGR ->
+// class and YUV -> class lookup tables (channelBits per channel), so
+// classifying a pixel is a single table load regardless of how many marker
+// colours are configured, and YUYV or NV12 camera frames are classified
+// as they are, without a conversion to BGR first. The tables are rebuilt
+// on a background thread, and only when a threshold actually changes.
+class ColourClassifier
+{
+public:
+	static const int channelBits = 6;
+	static const int cellCount = 1 << (3 * channelBits);
+
+	explicit ColourClassifier(const std::vector<MarkerColour>& colours);
+	~ColourClassifier();
+
+	ColourClassifier(const ColourClassifier&) = delete;
+	ColourClassifier& operator=(const ColourClassifier&) = delete;
+
+	int classCount() const;
+	std::string name(int classIndex) const;
+	HsvBounds bounds(int classIndex) const;
+
+	// Updates one marker's thresholds and schedules a rebuild if they changed.
+	void setBounds(int classIndex, const HsvBounds& bounds);
+
+	// Writes a CV_8U label image: 0 for background, classIndex + 1 for a
+	// pixel of that marker colour. image is laid out as format says; an
+	// NV12 image's labels are the size of its Y plane. Call from a single
+	// thread only.
+	void classify(const cv::Mat& image, PixelFormat format, cv::Mat& labels);
+
+private:
+	void buildLoop();
+	static void build(std::vector<uchar>& table, const std::vector<MarkerColour>& colours);
+
+	mutable std::mutex mutex_;
+	std::condition_variable wake_;
+	std::vector<MarkerColour> colours_;
+	bool dirty_;
+	bool running_;
+
+	TripleBuffer<std::vector<uchar>> tables_;
+	std::thread builder_;
+};
@@ -0,0 +1,107 @@
+#include "ControllerMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Scale and offset taking lo..hi onto 0..range, or range..0 if flipped.
+static void mapRange(float lo, float hi, bool flip, float range, float& scale, float& offset)
+{
+	scale = range / std::max(hi - lo, 1.0f);
+	offset = -lo * scale;
+	if (flip)
+	{
+		scale = -scale;
+		offset = range - offset;
+	}
+}
+
+ControllerMap::ControllerMap(const TileLayout& layout)
+	: padOf_(layout.zoneCount(), -1), frame_(1)
+{
+	for (int i = 0; i < layout.zoneCount(); i++)
+	{
+		const Zone& zone = layout.zone(i);
+		if (zone.type != ZoneType::XYPad)
+		{
+			continue;
+		}
+
+		Pad pad;
+		pad.channel = zone.channel;
+		pad.follow = 1.0f - zone.smoothing;
+		pad.lastFrame = 0;
+		for (int a = 0; a < 3; a++)
+		{
+			Axis& axis = pad.axes[a];
+			axis.kind = zone.axes[a].kind;
+			axis.controller = zone.axes[a].controller;
+			axis.range = axis.kind == ControllerKind::Cc7 ? 127.0f : 16383.0f;
+			axis.smoothed = 0;
+		}
+		const cv::Rect& bounds = zone.bounds;
+		mapRange(static_cast<float>(bounds.x), static_cast<float>(bounds.x + bounds.width - 1), false,
+			pad.axes[0].range, pad.axes[0].scale, pad.axes[0].offset);
+		// Up is more
+		mapRange(static_cast<float>(bounds.y), static_cast<float>(bounds.y + bounds.height - 1), true,
+			pad.axes[1].range, pad.axes[1].scale, pad.axes[1].offset);
+		mapRange(zone.minRadius, zone.maxRadius, false, pad.axes[2].range, pad.axes[2].scale, pad.axes[2].offset);
+
+		padOf_[i] = static_cast<int>(pads_.size());
+		pads_.push_back(pad);
+	}
+	// At most two messages (a 14-bit pair) for each of three axes
+	events_.reserve(pads_.size() * 6);
+}
+
+void ControllerMap::beginFrame()
+{
+	events_.clear();
+	frame_++;
+}
+
+void ControllerMap::update(const Track& marker, int zone)
+{
+	const int index = padOf_[zone];
+	if (index < 0 || pads_[index].lastFrame == frame_)
+	{
+		return;
+	}
+	Pad& pad = pads_[index];
+	// Entering the pad jumps to the marker instead of gliding from where
+	// the last one left
+	const bool entered = pad.lastFrame + 1 != frame_;
+	pad.lastFrame = frame_;
+
+	const float inputs[3] = { marker.position.x, marker.position.y, marker.radius };
+	for (int a = 0; a < 3; a++)
+	{
+		Axis& axis = pad.axes[a];
+		if (axis.kind == ControllerKind::None)
+		{
+			continue;
+		}
+		float value = std::min(axis.range, std::max(0.0f, inputs[a] * axis.scale + axis.offset));
+		axis.smoothed = entered ? value : axis.smoothed + pad.follow * (value - axis.smoothed);
+		emit(pad, axis);
+	}
+}
+
+void ControllerMap::emit(const Pad& pad, const Axis& axis)
+{
+	const int value = static_cast<int>(std::lround(axis.smoothed));
+	switch (axis.kind)
+	{
+	case ControllerKind::Cc7:
+		events_.push_back(MidiEvent::controlChange(pad.channel, axis.controller, value));
+		break;
+	case ControllerKind::Cc14:
+		events_.push_back(MidiEvent::controlChange(pad.channel, axis.controller, value >> 7));
+		events_.push_back(MidiEvent::controlChange(pad.channel, axis.controller + 32, value & 0x7F));
+		break;
+	case ControllerKind::PitchBend:
+		events_.push_back(MidiEvent::pitchBend(pad.channel, value));
+		break;
+	default:
+		break;
+	}
+}
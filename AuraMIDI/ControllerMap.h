@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "MarkerTracker.h"
+#include "MidiEngine.h"
+#include "TileLayout.h"
+
+// Turns markers on XY pads into controller messages. The mapping of every
+// pad axis is worked out once from the layout as a scale and offset
+// straight from frame coordinates (or marker radius) to the controller
+// range, so each frame costs a multiply-add and a smoothing step per axis.
+// Values are smoothed per pad, starting afresh whenever a marker enters,
+// and sent every frame a marker is on the pad; the output shaper drops
+// the ones that did not change.
+class ControllerMap
+{
+public:
+	explicit ControllerMap(const TileLayout& layout);
+
+	// Forgets the previous frame's events.
+	void beginFrame();
+
+	// Moves the controllers of zone, an XY pad, to where marker is. Only
+	// the first marker on a pad in a frame counts.
+	void update(const Track& marker, int zone);
+
+	// This frame's controller messages.
+	const std::vector<MidiEvent>& events() const { return events_; }
+
+private:
+	struct Axis
+	{
+		ControllerKind kind;
+		int controller;
+		float scale;  // Controller steps per pixel
+		float offset;
+		float range;  // Largest value: 127 or 16383
+		float smoothed;
+	};
+
+	struct Pad
+	{
+		Axis axes[3]; // x, y, size
+		int channel;
+		float follow; // 1 - smoothing
+		uint64_t lastFrame; // Last frame a marker was on it
+	};
+
+	void emit(const Pad& pad, const Axis& axis);
+
+	std::vector<int> padOf_; // Per zone, its pad or -1
+	std::vector<Pad> pads_;
+	std::vector<MidiEvent> events_;
+	uint64_t frame_;
+};
@@ -0,0 +1,278 @@
+#include "FrameCapture.h"
+
+#include <iostream>
+
+#include "V4l2Capture.h"
+
+// Assumed when a clip does not say
+static const double defaultFps = 30;
+// How long the capture thread waits for a V4L2 frame before checking
+// whether it should stop
+static const int v4l2TimeoutMs = 100;
+
+const cv::Mat& bgrImage(const cv::Mat& image, PixelFormat format, cv::Mat& scratch)
+{
+	switch (format)
+	{
+	case PixelFormat::Yuyv:
+		cv::cvtColor(image, scratch, cv::COLOR_YUV2BGR_YUYV);
+		return scratch;
+	case PixelFormat::Nv12:
+		cv::cvtColor(image, scratch, cv::COLOR_YUV2BGR_NV12);
+		return scratch;
+	default:
+		return image;
+	}
+}
+
+CameraConfig CameraConfig::fromJson(const Json::Value& value)
+{
+	CameraConfig config;
+	if (!value.isObject())
+	{
+		return config;
+	}
+	config.device = value.get("device", config.device).asInt();
+	const std::string backend = value.get("backend", "opencv").asString();
+	config.v4l2 = backend == "v4l2";
+	if (!config.v4l2 && backend != "opencv")
+	{
+		std::cout << "Unknown camera backend \"" << backend << "\", using opencv" << std::endl;
+	}
+	config.width = value.get("width", config.width).asInt();
+	config.height = value.get("height", config.height).asInt();
+	config.fps = value.get("fps", config.fps).asInt();
+	config.format = value.get("format", config.format).asString();
+	config.buffers = value.get("buffers", config.buffers).asInt();
+	return config;
+}
+
+FrameCapture::FrameCapture(const CameraConfig& config)
+	: running_(false), captured_(0), dropped_(0), recording_(false), unrecorded_(0)
+{
+	if (config.v4l2)
+	{
+		camera_.reset(new V4l2Capture());
+		if (camera_->open(config))
+		{
+			return;
+		}
+		camera_.reset();
+		std::cout << "Falling back to OpenCV capture" << std::endl;
+	}
+
+	cap_.open(config.device);
+	if (config.width > 0 && config.height > 0)
+	{
+		cap_.set(cv::CAP_PROP_FRAME_WIDTH, config.width);
+		cap_.set(cv::CAP_PROP_FRAME_HEIGHT, config.height);
+	}
+	if (config.fps > 0)
+	{
+		cap_.set(cv::CAP_PROP_FPS, config.fps);
+	}
+	// Where the backend allows it, one frame of buffering instead of several
+	cap_.set(cv::CAP_PROP_BUFFERSIZE, 1);
+}
+
+FrameCapture::FrameCapture(const std::string& path)
+	: running_(false), captured_(0), dropped_(0), recording_(false), unrecorded_(0)
+{
+	if (FramePlayer::exists(path))
+	{
+		player_.reset(new FramePlayer(path));
+	}
+	else
+	{
+		cap_.open(path);
+	}
+}
+
+FrameCapture::~FrameCapture()
+{
+	stop();
+	cap_.release();
+	// Any frame still pointing into the driver's buffers goes with them
+	camera_.reset();
+}
+
+bool FrameCapture::isOpened() const
+{
+	return player_ ? player_->isOpened() : camera_ ? camera_->isOpened() : cap_.isOpened();
+}
+
+void FrameCapture::start()
+{
+	if (running_ || !isOpened() || player_)
+	{
+		return;
+	}
+	running_ = true;
+	if (recorder_)
+	{
+		recording_ = true;
+		recordThread_ = std::thread(&FrameCapture::writeRecording, this);
+	}
+	thread_ = std::thread(&FrameCapture::run, this);
+}
+
+void FrameCapture::stop()
+{
+	running_ = false;
+	if (thread_.joinable())
+	{
+		thread_.join();
+	}
+	// The writer finishes what is queued first
+	recording_ = false;
+	if (recordThread_.joinable())
+	{
+		recordThread_.join();
+	}
+	if (recorder_ && unrecorded_ > 0)
+	{
+		std::cout << unrecorded_ << " frames were left out of the recording while the disk fell behind" << std::endl;
+	}
+	recorder_.reset();
+}
+
+bool FrameCapture::record(const RecordConfig& config)
+{
+	if (running_ || config.path.empty())
+	{
+		return false;
+	}
+	recorder_.reset(new FrameRecorder(config));
+	recordQueue_.reset(new SpscQueue<CapturedFrame>(config.buffers, OverflowPolicy::Block));
+	spareFrames_.reset(new SpscQueue<CapturedFrame>(config.buffers, OverflowPolicy::Block));
+	for (int i = 0; i < config.buffers; i++)
+	{
+		spareFrames_->push(CapturedFrame(), running_);
+	}
+	std::cout << "Recording frames to " << config.path << std::endl;
+	return true;
+}
+
+bool FrameCapture::acquire()
+{
+	return buffer_.acquire();
+}
+
+const CapturedFrame& FrameCapture::frame() const
+{
+	return buffer_.readBuffer();
+}
+
+bool FrameCapture::read(CapturedFrame& frame)
+{
+	if (player_)
+	{
+		const uint64_t index = captured_.load(std::memory_order_relaxed);
+		if (index >= player_->frameCount())
+		{
+			return false;
+		}
+		player_->frame(index, frame);
+		captured_.store(index + 1, std::memory_order_relaxed);
+		return true;
+	}
+	if (!cap_.read(frame.image) || frame.image.empty())
+	{
+		return false;
+	}
+	double fps = cap_.get(cv::CAP_PROP_FPS);
+	fps = fps > 0 ? fps : defaultFps;
+	const uint64_t index = captured_.fetch_add(1, std::memory_order_relaxed);
+	frame.sequence = index + 1;
+	frame.timestamp = std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(index / fps)));
+	return true;
+}
+
+uint64_t FrameCapture::capturedFrames() const
+{
+	return captured_.load(std::memory_order_relaxed);
+}
+
+uint64_t FrameCapture::droppedFrames() const
+{
+	return dropped_.load(std::memory_order_relaxed) + (camera_ ? camera_->skippedFrames() : 0);
+}
+
+void FrameCapture::run()
+{
+	uint64_t sequence = 0;
+	while (running_)
+	{
+		CapturedFrame& slot = buffer_.writeBuffer();
+
+		if (camera_)
+		{
+			// The consumer is done with whatever the slot held before it
+			// came back to this side of the triple buffer
+			if (slot.buffer >= 0)
+			{
+				camera_->release(slot.buffer);
+				slot.buffer = -1;
+				slot.image.release();
+			}
+			// The frame stays in the driver's buffer, stamped by the driver
+			if (!camera_->read(slot, v4l2TimeoutMs))
+			{
+				continue;
+			}
+		}
+		else
+		{
+			// read() reuses the slot's allocation when the frame size is unchanged
+			if (!cap_.read(slot.image) || slot.image.empty())
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			slot.timestamp = std::chrono::steady_clock::now();
+		}
+		slot.sequence = ++sequence;
+		if (recording_)
+		{
+			recordFrame(slot);
+		}
+
+		captured_.fetch_add(1, std::memory_order_relaxed);
+		if (buffer_.publish())
+		{
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+void FrameCapture::recordFrame(const CapturedFrame& frame)
+{
+	// The slot goes back to the camera, so the writer gets a copy
+	CapturedFrame copy;
+	if (!spareFrames_->tryPop(copy))
+	{
+		unrecorded_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	frame.image.copyTo(copy.image);
+	copy.format = frame.format;
+	copy.sequence = frame.sequence;
+	copy.timestamp = frame.timestamp;
+	recordQueue_->push(std::move(copy), recording_);
+}
+
+void FrameCapture::writeRecording()
+{
+	CapturedFrame frame;
+	while (recordQueue_->pop(frame, recording_))
+	{
+		if (!recorder_->write(frame))
+		{
+			std::cout << "Cannot write the frame recording, stopping it" << std::endl;
+			recording_ = false;
+			return;
+		}
+		spareFrames_->push(std::move(frame), recording_);
+	}
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "FrameRecording.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+
+// Pixel layout of a captured image. V4L2 cameras hand over their own
+// layout; everything else is converted to BGR on capture.
+enum class PixelFormat
+{
+	Bgr,  // CV_8UC3
+	Yuyv, // CV_8UC2, Y0 U Y1 V for each pair of pixels
+	Nv12  // CV_8UC1, the Y plane and below it the interleaved UV plane at half height
+};
+
+struct CapturedFrame
+{
+	cv::Mat image;
+	PixelFormat format = PixelFormat::Bgr;
+	uint64_t sequence = 0;
+	std::chrono::steady_clock::time_point timestamp;
+	int buffer = -1; // Driver buffer image points into, if any; see V4l2Capture
+};
+
+// image, laid out as format says, as BGR: the image itself when it is, or
+// else converted into scratch.
+const cv::Mat& bgrImage(const cv::Mat& image, PixelFormat format, cv::Mat& scratch);
+
+// Which camera, and how to talk to it. Reads "camera" from the
+// "pipeline" object, e.g.
+// "camera": { "device": 0, "backend": "v4l2", "width": 1280, "height": 720,
+//             "fps": 60, "format": "YUYV", "buffers": 2 }
+struct CameraConfig
+{
+	int device = 0;
+	// Talk to the V4L2 driver directly (Linux only), instead of through
+	// cv::VideoCapture, which it falls back to where that fails
+	bool v4l2 = false;
+	// 0 keeps what the camera does by default
+	int width = 0;
+	int height = 0;
+	int fps = 0;
+	// V4L2 only: the layout to ask for, YUYV, NV12 or MJPG, and how many
+	// buffers the driver may fill ahead of the capture thread
+	std::string format = "YUYV";
+	int buffers = 2;
+
+	static CameraConfig fromJson(const Json::Value& value);
+};
+
+class V4l2Capture;
+
+// Runs the camera on its own thread and publishes every frame into a
+// triple buffer, so the processing loop always picks up the newest frame
+// without ever blocking on the camera. Frames that are overwritten before
+// the consumer gets to them, or that the driver had to skip, are counted
+// as dropped. With the V4L2 backend, frames stay in the driver's buffers
+// until the consumer has moved on from them.
+//
+// While recording, the capture thread copies each frame into one of a few
+// preallocated buffers and a writer thread of its own puts it on disk, so
+// a disk stall never holds up capture. When every buffer is still waiting
+// to be written, frames are left out of the recording and counted.
+//
+// A recorded clip can instead be read frame by frame with read(), on the
+// calling thread, so that none is dropped. A raw frame recording (see
+// FrameRecording.h) is read the same way, straight from memory.
+class FrameCapture
+{
+public:
+	explicit FrameCapture(const CameraConfig& config);
+	// A frame recording, a video file, or anything else VideoCapture opens
+	// by name.
+	explicit FrameCapture(const std::string& path);
+	~FrameCapture();
+
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+
+	bool isOpened() const;
+
+	void start();
+	void stop();
+
+	// Before start(): also writes every captured frame to a recording,
+	// until stop(). Returns false if config has no path.
+	bool record(const RecordConfig& config);
+
+	// Switches to the newest captured frame, if one arrived since the last
+	// call. The returned frame stays valid until the next successful call.
+	bool acquire();
+	const CapturedFrame& frame() const;
+
+	// Instead of start(): reads the next frame of a clip, stamped with its
+	// time in the clip from the clip's frame rate, so replaying a clip
+	// gives the same timestamps at any speed; a frame recording gives the
+	// times the frames were captured, and images that point into the
+	// mapped file. Returns false at the end.
+	bool read(CapturedFrame& frame);
+
+	uint64_t capturedFrames() const;
+	uint64_t droppedFrames() const;
+
+private:
+	void run();
+	void recordFrame(const CapturedFrame& frame);
+	void writeRecording();
+
+	cv::VideoCapture cap_;
+	std::unique_ptr<V4l2Capture> camera_;
+	std::unique_ptr<FramePlayer> player_;
+	TripleBuffer<CapturedFrame> buffer_;
+	std::thread thread_;
+	std::atomic<bool> running_;
+	std::atomic<uint64_t> captured_;
+	std::atomic<uint64_t> dropped_;
+
+	// Recording: frames go from the capture thread to the writer thread
+	// and their buffers come back, so once every buffer has been used
+	// nothing is allocated
+	std::unique_ptr<FrameRecorder> recorder_; // Writer thread only while running
+	std::unique_ptr<SpscQueue<CapturedFrame>> recordQueue_;
+	std::unique_ptr<SpscQueue<CapturedFrame>> spareFrames_;
+	std::thread recordThread_;
+	std::atomic<bool> recording_;
+	std::atomic<uint64_t> unrecorded_; // Left out while the writer was behind
+};
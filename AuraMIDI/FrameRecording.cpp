@@ -0,0 +1,305 @@
+#include "FrameRecording.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "FrameCapture.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char magic[8] = { 'A', 'U', 'R', 'A', 'F', 'R', 'M', 0 };
+static const uint32_t version = 1;
+// Records start on a cache line, so row kernels see aligned pixels
+static const uint64_t recordAlign = 64;
+
+struct SegmentHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerBytes;
+	int32_t width;
+	int32_t height;
+	int32_t type;        // OpenCV element type, e.g. CV_8UC3
+	uint32_t fourcc;     // Pixel layout: 'BGR3', 'YUYV' or 'NV12'
+	uint64_t rowBytes;
+	uint64_t recordBytes; // Stamp, pixels and padding
+	char reserved[16];
+};
+
+struct FrameStamp
+{
+	uint64_t sequence;
+	int64_t nanoseconds; // Since the first frame of the recording
+	char reserved[48];
+};
+
+static_assert(sizeof(SegmentHeader) == 64, "segment header is one cache line");
+static_assert(sizeof(FrameStamp) == recordAlign, "frame stamp is one cache line");
+
+static uint32_t fourccOf(PixelFormat format)
+{
+	switch (format)
+	{
+	case PixelFormat::Yuyv:
+		return cv::VideoWriter::fourcc('Y', 'U', 'Y', 'V');
+	case PixelFormat::Nv12:
+		return cv::VideoWriter::fourcc('N', 'V', '1', '2');
+	default:
+		return cv::VideoWriter::fourcc('B', 'G', 'R', '3');
+	}
+}
+
+static PixelFormat formatOf(uint32_t fourcc)
+{
+	for (PixelFormat format : { PixelFormat::Yuyv, PixelFormat::Nv12 })
+	{
+		if (fourcc == fourccOf(format))
+		{
+			return format;
+		}
+	}
+	return PixelFormat::Bgr;
+}
+
+static std::string segmentName(const std::string& path, int index)
+{
+	std::ostringstream name;
+	name << path << '.' << std::setw(3) << std::setfill('0') << index << ".frames";
+	return name.str();
+}
+
+RecordConfig RecordConfig::fromJson(const Json::Value& value)
+{
+	RecordConfig config;
+	if (!value.isObject())
+	{
+		return config;
+	}
+	config.path = value.get("path", config.path).asString();
+	const int megabytes = value.get("segmentMB", static_cast<int>(config.segmentBytes >> 20)).asInt();
+	config.segmentBytes = static_cast<uint64_t>(std::max(megabytes, 1)) << 20;
+	config.buffers = std::max(1, value.get("buffers", config.buffers).asInt());
+	return config;
+}
+
+FrameRecorder::FrameRecorder(const RecordConfig& config)
+	: config_(config), segments_(0), segmentUsed_(0), recordBytes_(0), type_(-1), format_(PixelFormat::Bgr), frames_(0)
+{
+}
+
+FrameRecorder::~FrameRecorder()
+{
+	file_.close();
+	if (frames_ > 0)
+	{
+		std::cout << "Recorded " << frames_ << " frames to " << config_.path << " in " << segments_ << " segments" << std::endl;
+	}
+}
+
+bool FrameRecorder::openSegment(const CapturedFrame& frame)
+{
+	const cv::Mat& image = frame.image;
+	file_.close();
+	const std::string name = segmentName(config_.path, segments_);
+	file_.open(name, std::ios::binary | std::ios::trunc);
+	if (!file_)
+	{
+		std::cout << "Cannot create " << name << std::endl;
+		return false;
+	}
+	segments_++;
+
+	size_ = image.size();
+	type_ = image.type();
+	format_ = frame.format;
+	const uint64_t rowBytes = static_cast<uint64_t>(image.cols) * image.elemSize();
+	const uint64_t pixelBytes = rowBytes * image.rows;
+	recordBytes_ = sizeof(FrameStamp) + (pixelBytes + recordAlign - 1) / recordAlign * recordAlign;
+	record_.assign(sizeof(FrameStamp) + recordAlign, 0);
+
+	SegmentHeader header = {};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.headerBytes = sizeof(SegmentHeader);
+	header.width = image.cols;
+	header.height = image.rows;
+	header.type = type_;
+	header.fourcc = fourccOf(format_);
+	header.rowBytes = rowBytes;
+	header.recordBytes = recordBytes_;
+	file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	segmentUsed_ = sizeof(header);
+	return static_cast<bool>(file_);
+}
+
+bool FrameRecorder::write(const CapturedFrame& frame)
+{
+	const cv::Mat& image = frame.image;
+	if (image.empty())
+	{
+		return true;
+	}
+	if (frames_ == 0)
+	{
+		first_ = frame.timestamp;
+	}
+	// One geometry per segment, so a size change starts a new one too
+	if (!file_.is_open() || image.size() != size_ || image.type() != type_ || frame.format != format_
+		|| segmentUsed_ + recordBytes_ > config_.segmentBytes)
+	{
+		if (!openSegment(frame))
+		{
+			return false;
+		}
+	}
+
+	FrameStamp& stamp = *reinterpret_cast<FrameStamp*>(record_.data());
+	stamp.sequence = frame.sequence;
+	stamp.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.timestamp - first_).count();
+	file_.write(record_.data(), sizeof(FrameStamp));
+
+	const size_t rowBytes = image.cols * image.elemSize();
+	if (image.isContinuous())
+	{
+		file_.write(reinterpret_cast<const char*>(image.data), rowBytes * image.rows);
+	}
+	else
+	{
+		for (int y = 0; y < image.rows; y++)
+		{
+			file_.write(reinterpret_cast<const char*>(image.ptr(y)), rowBytes);
+		}
+	}
+	const uint64_t padding = recordBytes_ - sizeof(FrameStamp) - rowBytes * image.rows;
+	file_.write(record_.data() + sizeof(FrameStamp), padding);
+
+	segmentUsed_ += recordBytes_;
+	frames_++;
+	return static_cast<bool>(file_);
+}
+
+FramePlayer::FramePlayer(const std::string& path)
+{
+	for (int index = 0; ; index++)
+	{
+		const std::string name = segmentName(path, index);
+		if (!std::ifstream(name) || !mapSegment(name))
+		{
+			break;
+		}
+	}
+}
+
+FramePlayer::~FramePlayer()
+{
+	for (const Segment& segment : segments_)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(segment.view);
+#else
+		munmap(segment.view, segment.bytes);
+#endif
+	}
+}
+
+bool FramePlayer::exists(const std::string& path)
+{
+	return static_cast<bool>(std::ifstream(segmentName(path, 0)));
+}
+
+bool FramePlayer::mapSegment(const std::string& name)
+{
+	// The view keeps the file open; the handles are not needed after mapping
+	void* view = nullptr;
+	size_t bytes = 0;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &size) && size.QuadPart >= static_cast<LONGLONG>(sizeof(SegmentHeader)))
+	{
+		bytes = static_cast<size_t>(size.QuadPart);
+		mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	}
+	if (mapping)
+	{
+		view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+#else
+	int file = open(name.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(file, &info) == 0 && info.st_size >= static_cast<off_t>(sizeof(SegmentHeader)))
+	{
+		bytes = static_cast<size_t>(info.st_size);
+		view = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+		if (view == MAP_FAILED)
+		{
+			view = nullptr;
+		}
+		else
+		{
+			// Replay reads each frame once, front to back
+			madvise(view, bytes, MADV_SEQUENTIAL);
+		}
+	}
+	close(file);
+#endif
+	if (!view)
+	{
+		std::cout << "Cannot map " << name << std::endl;
+		return false;
+	}
+	segments_.push_back({ view, bytes });
+
+	unsigned char* base = static_cast<unsigned char*>(view);
+	const SegmentHeader& header = *reinterpret_cast<const SegmentHeader*>(base);
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version
+		|| header.recordBytes < sizeof(FrameStamp) + header.rowBytes * header.height)
+	{
+		std::cout << name << " is not a frame recording" << std::endl;
+		return false;
+	}
+
+	// Only whole records count: the last one may have been cut short
+	const size_t count = (bytes - header.headerBytes) / header.recordBytes;
+	for (size_t i = 0; i < count; i++)
+	{
+		unsigned char* record = base + header.headerBytes + i * header.recordBytes;
+		const FrameStamp& stamp = *reinterpret_cast<const FrameStamp*>(record);
+		frames_.push_back({ record + sizeof(FrameStamp), cv::Size(header.width, header.height), header.type,
+			formatOf(header.fourcc), stamp.sequence, stamp.nanoseconds });
+	}
+	return true;
+}
+
+void FramePlayer::frame(size_t index, CapturedFrame& out) const
+{
+	const Frame& frame = frames_[index];
+	out.image = cv::Mat(frame.size, frame.type, frame.pixels);
+	out.format = frame.format;
+	out.sequence = frame.sequence;
+	out.timestamp = std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::nanoseconds(frame.nanoseconds)));
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <json/json.h>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct CapturedFrame;
+enum class PixelFormat;
+
+// Raw frame recordings: captured frames as they came off the camera, in
+// its own pixel layout, with their capture times, uncompressed, so
+// replaying one costs no decoding.
+//
+// A recording is a run of segment files, path.000.frames, path.001.frames
+// and so on. Each segment starts with a header giving the frame geometry,
+// followed by fixed-size records: a 64-byte stamp (sequence and time),
+// then the pixels, padded to 64 bytes. With every record the same size
+// the nth frame is found by arithmetic and a segment cut short by a crash
+// is still readable up to its last whole frame.
+struct RecordConfig
+{
+	std::string path;                  // Empty for no recording
+	uint64_t segmentBytes = 1ull << 30; // A new segment past this size
+	int buffers = 8;                   // Frames waiting to be written at most
+
+	// Reads "record": { "path": "session", "segmentMB": 1024, "buffers": 8 }
+	static RecordConfig fromJson(const Json::Value& value);
+};
+
+// Writes frames to a recording, starting a new segment when the current
+// one is full or the frame size changes. For a single thread.
+class FrameRecorder
+{
+public:
+	explicit FrameRecorder(const RecordConfig& config);
+	~FrameRecorder();
+
+	FrameRecorder(const FrameRecorder&) = delete;
+	FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+	// Returns false if the frame could not be written; the recording so
+	// far stays readable.
+	bool write(const CapturedFrame& frame);
+
+	uint64_t frames() const { return frames_; }
+	int segments() const { return segments_; }
+
+private:
+	bool openSegment(const CapturedFrame& frame);
+
+	RecordConfig config_;
+	std::ofstream file_;
+	int segments_;
+	uint64_t segmentUsed_;
+	uint64_t recordBytes_;
+	cv::Size size_;
+	int type_;
+	PixelFormat format_;
+	uint64_t frames_;
+	std::chrono::steady_clock::time_point first_;
+	std::vector<char> record_; // Stamp and padding of the record being written
+};
+
+// Maps a recording into memory and hands out its frames as cv::Mat headers
+// pointing straight into the mapping: no reads, no copies. The mapping is
+// copy-on-write, so writing into a frame never changes the file.
+class FramePlayer
+{
+public:
+	explicit FramePlayer(const std::string& path);
+	~FramePlayer();
+
+	FramePlayer(const FramePlayer&) = delete;
+	FramePlayer& operator=(const FramePlayer&) = delete;
+
+	// Whether path names a recording, i.e. path.000.frames exists.
+	static bool exists(const std::string& path);
+
+	bool isOpened() const { return !frames_.empty(); }
+	size_t frameCount() const { return frames_.size(); }
+
+	// Frame index, stamped with its time since the first recorded frame.
+	// The image stays valid while the player lives.
+	void frame(size_t index, CapturedFrame& out) const;
+
+private:
+	struct Segment
+	{
+		void* view;
+		size_t bytes;
+	};
+
+	struct Frame
+	{
+		unsigned char* pixels;
+		cv::Size size;
+		int type;
+		PixelFormat format;
+		uint64_t sequence;
+		int64_t nanoseconds;
+	};
+
+	bool mapSegment(const std::string& name);
+
+	std::vector<Segment> segments_;
+	std::vector<Frame> frames_;
+};
@@ -0,0 +1,97 @@
+#include "HitPredictor.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Slower markers are drifting, not striking
+static const float minApproachSpeed = 60.0f;
+// Velocity of the gentlest hit
+static const int minVelocity = 32;
+// Weight of each new sample in the smoothed processing delay and bias
+static const float smoothing = 0.1f;
+
+HitPredictor::HitPredictor(float latencyMs, float speedForFullVelocity)
+	: latency_(latencyMs / 1000.0f), speedForFullVelocity_(std::max(1.0f, speedForFullVelocity)),
+	processing_(0), frameInterval_(1.0f / 30), lookAhead_(latencyMs / 1000.0f), bias_(0),
+	predictedHits_(0), lateHits_(0), falseTriggers_(0), absoluteError_(0)
+{
+}
+
+void HitPredictor::beginFrame(TimePoint captured, float frameInterval)
+{
+	float processing = std::chrono::duration<float>(std::chrono::steady_clock::now() - captured).count();
+	processing_ += smoothing * (processing - processing_);
+	frameInterval_ = frameInterval;
+	// Half a frame on top: waiting for the next frame would be later still
+	lookAhead_ = latency_ + processing_ + frameInterval_ / 2;
+}
+
+int HitPredictor::predict(const Track& marker, const TileLayout& layout, float& seconds) const
+{
+	float speed = static_cast<float>(cv::norm(marker.velocity));
+	if (speed < minApproachSpeed)
+	{
+		return -1;
+	}
+
+	// One label cell per step, so no zone can be stepped over
+	const float step = layout.cellSize() / speed;
+	const float horizon = lookAhead_ - bias_;
+	for (float t = step; t <= horizon; t += step)
+	{
+		int zone = layout.zoneAt(marker.position + marker.velocity * t);
+		// Sequencer tiles act on the next bar, so there is nothing to gain
+		if (zone >= 0 && (layout.zone(zone).type == ZoneType::Pattern || layout.zone(zone).type == ZoneType::Pad)
+			&& !layout.zone(zone).sequenced)
+		{
+			seconds = std::max(0.0f, t + bias_);
+			return zone;
+		}
+	}
+	return -1;
+}
+
+void HitPredictor::observeEntry(TimePoint expected, TimePoint observed)
+{
+	// The entry happened somewhere between the previous frame and this one.
+	// expected already has the bias in it, so error is what the bias has
+	// yet to correct, and adding a share of it each time settles the bias
+	// on the whole offset
+	float error = std::chrono::duration<float>(observed - expected).count() - frameInterval_ / 2;
+	bias_ += smoothing * error;
+	bias_ = std::min(std::max(bias_, -lookAhead_), lookAhead_);
+	absoluteError_ += std::fabs(error);
+	predictedHits_++;
+}
+
+void HitPredictor::observeFalseTrigger()
+{
+	falseTriggers_++;
+}
+
+void HitPredictor::observeLateHit()
+{
+	lateHits_++;
+}
+
+bool HitPredictor::expired(TimePoint expected, TimePoint now) const
+{
+	return std::chrono::duration<float>(now - expected).count() > lookAhead_ + frameInterval_;
+}
+
+int HitPredictor::velocityFor(const Track& marker) const
+{
+	float speed = static_cast<float>(cv::norm(marker.velocity));
+	return minVelocity + static_cast<int>((127 - minVelocity) * std::min(1.0f, speed / speedForFullVelocity_));
+}
+
+void HitPredictor::printStats(std::ostream& out) const
+{
+	out << "Predicted hits: " << predictedHits_ << ", late hits: " << lateHits_
+		<< ", false triggers: " << falseTriggers_ << "\n";
+	if (predictedHits_ > 0)
+	{
+		out << "Mean entry error " << 1000 * absoluteError_ / predictedHits_ << " ms, bias "
+			<< 1000 * bias_ << " ms, look-ahead " << 1000 * lookAhead_ << " ms" << std::endl;
+	}
+}
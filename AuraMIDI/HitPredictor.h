@@ -0,0 +1,64 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+#include "MarkerTracker.h"
+#include "TileLayout.h"
+
+// Fires notes before a marker reaches a tile so the sound lands with the
+// gesture rather than one capture and processing delay behind it.
+//
+// The look-ahead is the configured latency the program cannot see (camera
+// exposure, USB transfer, MIDI output) plus the processing delay it can,
+// measured on every frame. A note fires once the filtered trajectory
+// reaches a playable zone within the look-ahead; the trajectory is walked
+// through the layout's label image one cell at a time, so any zone shape
+// works and the cost does not grow with the number of zones. When the marker then really
+// enters, the error between predicted and observed entry is folded into a
+// bias that corrects later predictions; predictions that never come true
+// are counted as false triggers.
+class HitPredictor
+{
+public:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	// speedForFullVelocity: approach speed (pixels per second) that plays 127.
+	HitPredictor(float latencyMs, float speedForFullVelocity);
+
+	// Call once per frame before predicting.
+	void beginFrame(TimePoint captured, float frameInterval);
+
+	// First playable zone the marker reaches within the look-ahead, or -1.
+	// seconds receives the predicted time from the frame to the entry.
+	int predict(const Track& marker, const TileLayout& layout, float& seconds) const;
+
+	// The armed marker actually entered its tile in the frame captured at
+	// observed.
+	void observeEntry(TimePoint expected, TimePoint observed);
+	void observeFalseTrigger();
+	void observeLateHit();
+
+	// An armed prediction that has not come true by now is wrong.
+	bool expired(TimePoint expected, TimePoint now) const;
+
+	// MIDI velocity (32..127) for the marker's approach speed.
+	int velocityFor(const Track& marker) const;
+
+	void printStats(std::ostream& out) const;
+
+private:
+	float latency_;              // Seconds, configured
+	float speedForFullVelocity_;
+	float processing_;           // Seconds, smoothed
+	float frameInterval_;
+	float lookAhead_;
+	float bias_;                 // Observed minus unbiased predicted entry, integrated
+
+	long predictedHits_;
+	long lateHits_;
+	long falseTriggers_;
+	double absoluteError_;
+};
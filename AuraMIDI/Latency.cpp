@@ -0,0 +1,104 @@
+#include "Latency.h"
+
+#include <iomanip>
+
+LatencyHistogram::LatencyHistogram()
+	: count_(0), max_(0)
+{
+	for (std::atomic<uint64_t>& bucket : counts_)
+	{
+		bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+int LatencyHistogram::bucketOf(uint64_t us)
+{
+	// Values below 2 * subCount have a bucket each; above, every power of
+	// two is split into subCount buckets
+	int shift = 0;
+	while ((us >> shift) >= 2 * subCount)
+	{
+		shift++;
+	}
+	const int bucket = shift * subCount + static_cast<int>(us >> shift);
+	return bucket < bucketCount ? bucket : bucketCount - 1;
+}
+
+uint64_t LatencyHistogram::highestIn(int bucket)
+{
+	if (bucket < 2 * subCount)
+	{
+		return static_cast<uint64_t>(bucket);
+	}
+	const int shift = bucket / subCount - 1;
+	return ((static_cast<uint64_t>(bucket - shift * subCount) + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+	// Single writer: a load and a store, no read-modify-write needed
+	std::atomic<uint64_t>& bucket = counts_[bucketOf(us)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if (us > max_.load(std::memory_order_relaxed))
+	{
+		max_.store(us, std::memory_order_relaxed);
+	}
+}
+
+uint64_t LatencyHistogram::count() const
+{
+	return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::max() const
+{
+	return max_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+	const uint64_t total = count();
+	if (total == 0)
+	{
+		return 0;
+	}
+	// The rank to reach, at least 1 so p0 is the smallest value
+	uint64_t rank = static_cast<uint64_t>(fraction * total + 0.5);
+	rank = rank < 1 ? 1 : rank;
+	uint64_t seen = 0;
+	for (int i = 0; i < bucketCount; i++)
+	{
+		seen += counts_[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+		{
+			// Never past the largest value actually seen
+			const uint64_t value = highestIn(i);
+			return value < max() ? value : max();
+		}
+	}
+	return max();
+}
+
+void LatencyReport::print(std::ostream& out) const
+{
+	static const char* names[stageCount] = { "segmented", "blobs", "decided", "MIDI out", "displayed" };
+	out << "Latency since capture, in ms:" << std::setw(10) << "count" << std::setw(9) << "p50" << std::setw(9) << "p99"
+		<< std::setw(9) << "p99.9" << std::setw(9) << "max" << std::endl;
+	const std::ios::fmtflags flags = out.flags();
+	const std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(2);
+	for (int i = 0; i < stageCount; i++)
+	{
+		const LatencyHistogram& stage = stages_[i];
+		if (stage.count() == 0)
+		{
+			continue;
+		}
+		out << "  " << std::left << std::setw(27) << names[i] << std::right << std::setw(10) << stage.count()
+			<< std::setw(9) << stage.percentile(0.5) / 1000.0 << std::setw(9) << stage.percentile(0.99) / 1000.0
+			<< std::setw(9) << stage.percentile(0.999) / 1000.0 << std::setw(9) << stage.max() / 1000.0 << std::endl;
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
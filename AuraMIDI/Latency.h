@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Histogram of latencies in microseconds, HdrHistogram style: buckets are
+// linear within each power of two, 128 to a power, so every value is kept
+// to within 1% from 1 us up to over an hour, in a fixed 26 KB and with no
+// allocation. One thread records; any thread may read at any time and
+// sees every count as it was at some moment, without locking.
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	// Writer side, for a single thread.
+	void record(uint64_t us);
+
+	uint64_t count() const;
+	uint64_t max() const;
+	// The value below which fraction of all recorded values lie, to within
+	// a bucket.
+	uint64_t percentile(double fraction) const;
+
+private:
+	static const int subBits = 7;
+	static const int subCount = 1 << subBits;
+	// Up to 2^32 us
+	static const int bucketCount = (32 - subBits + 1) * subCount;
+
+	static int bucketOf(uint64_t us);
+	static uint64_t highestIn(int bucket);
+
+	std::atomic<uint64_t> counts_[bucketCount];
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> max_;
+};
+
+// Where a frame has got to.
+enum class LatencyStage
+{
+	Segmented, // Colour labels and noise suppression done
+	Blobs,     // Markers found
+	Decided,   // Tracking and hit decisions done
+	MidiOut,   // A Note On it played handed to the MIDI port
+	Displayed  // On screen
+};
+
+// How long after capture frames reach each stage. Every stage is recorded
+// by one thread: segmentation, tracking, the MIDI engine and the UI each
+// own theirs, so recording costs one clock read and two relaxed atomic
+// updates and nothing is shared between writers. Printing reads the
+// histograms while they are being written.
+class LatencyReport
+{
+public:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	LatencyReport() = default;
+	LatencyReport(const LatencyReport&) = delete;
+	LatencyReport& operator=(const LatencyReport&) = delete;
+
+	void record(LatencyStage stage, TimePoint captured)
+	{
+		record(stage, captured, std::chrono::steady_clock::now());
+	}
+
+	void record(LatencyStage stage, TimePoint captured, TimePoint reached)
+	{
+		const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(reached - captured).count();
+		stages_[static_cast<int>(stage)].record(us > 0 ? static_cast<uint64_t>(us) : 0);
+	}
+
+	// p50, p99, p99.9 and maximum per stage.
+	void print(std::ostream& out) const;
+
+private:
+	static const int stageCount = 5;
+
+	LatencyHistogram stages_[stageCount];
+};
@@ -0,0 +1,144 @@
+#include "MarkerTracker.h"
+
+#include <algorithm>
+
+MarkerTracker::MarkerTracker(int maxTracks, float matchDistance, float alpha, float beta, int maxMissed)
+	: maxTracks_(std::max(1, maxTracks)), matchDistance_(matchDistance), alpha_(alpha), beta_(beta),
+	maxMissed_(maxMissed), nextId_(1), hasTimestamp_(false), frameInterval_(1.0f / 30)
+{
+	tracks_.reserve(maxTracks_);
+	predicted_.reserve(maxTracks_);
+	byX_.reserve(maxTracks_);
+	candidates_.reserve(static_cast<size_t>(maxTracks_) * maxTracks_);
+	trackMatched_.reserve(maxTracks_);
+	blobMatched_.reserve(maxTracks_);
+}
+
+std::vector<Track>& MarkerTracker::tracks()
+{
+	return tracks_;
+}
+
+const std::vector<Track>& MarkerTracker::tracks() const
+{
+	return tracks_;
+}
+
+float MarkerTracker::frameInterval() const
+{
+	return frameInterval_;
+}
+
+std::vector<Track>& MarkerTracker::update(const std::vector<Blob>& blobs, std::chrono::steady_clock::time_point timestamp)
+{
+	// Seconds since the previous frame, kept sane across stalls and the first frame
+	float dt = 1.0f / 30;
+	if (hasTimestamp_)
+	{
+		dt = std::chrono::duration<float>(timestamp - lastTimestamp_).count();
+		dt = std::min(std::max(dt, 0.001f), 0.2f);
+	}
+	lastTimestamp_ = timestamp;
+	hasTimestamp_ = true;
+	frameInterval_ = dt;
+
+	// Only the largest blobs can become markers
+	const int blobCount = std::min(static_cast<int>(blobs.size()), maxTracks_);
+	const int trackCount = static_cast<int>(tracks_.size());
+	const float gate2 = matchDistance_ * matchDistance_;
+
+	predicted_.clear();
+	for (const Track& track : tracks_)
+	{
+		predicted_.push_back(track.position + track.velocity * (dt * (track.missed + 1)));
+	}
+
+	byX_.clear();
+	for (int b = 0; b < blobCount; b++)
+	{
+		byX_.push_back(b);
+	}
+	std::sort(byX_.begin(), byX_.end(), [&](int a, int b) { return blobs[a].centroid.x < blobs[b].centroid.x; });
+
+	// Pairs inside each track's gate
+	candidates_.clear();
+	for (int t = 0; t < trackCount; t++)
+	{
+		const cv::Point2f& p = predicted_[t];
+		auto first = std::lower_bound(byX_.begin(), byX_.end(), p.x - matchDistance_,
+			[&](int b, float x) { return blobs[b].centroid.x < x; });
+		for (auto it = first; it != byX_.end() && blobs[*it].centroid.x <= p.x + matchDistance_; ++it)
+		{
+			const Blob& blob = blobs[*it];
+			// Markers of different colours never swap identities
+			if (blob.classId != 0 && tracks_[t].classId != 0 && blob.classId != tracks_[t].classId)
+			{
+				continue;
+			}
+			cv::Point2f d = blob.centroid - p;
+			float distance2 = d.dot(d);
+			if (distance2 <= gate2)
+			{
+				Candidate candidate = { distance2, t, *it };
+				candidates_.push_back(candidate);
+			}
+		}
+	}
+	std::sort(candidates_.begin(), candidates_.end(),
+		[](const Candidate& a, const Candidate& b) { return a.distance2 < b.distance2; });
+
+	trackMatched_.assign(trackCount, 0);
+	blobMatched_.assign(blobCount, 0);
+	for (const Candidate& candidate : candidates_)
+	{
+		if (trackMatched_[candidate.track] || blobMatched_[candidate.blob])
+		{
+			continue;
+		}
+		trackMatched_[candidate.track] = 1;
+		blobMatched_[candidate.blob] = 1;
+
+		Track& track = tracks_[candidate.track];
+		const Blob& blob = blobs[candidate.blob];
+		float elapsed = dt * (track.missed + 1);
+		cv::Point2f residual = blob.centroid - predicted_[candidate.track];
+		track.position = predicted_[candidate.track] + alpha_ * residual;
+		track.velocity += (beta_ / elapsed) * residual;
+		track.radius = blob.radius;
+		if (blob.classId != 0)
+		{
+			track.classId = blob.classId;
+		}
+		track.missed = 0;
+	}
+
+	for (int t = 0; t < trackCount; t++)
+	{
+		tracks_[t].age++;
+		if (!trackMatched_[t])
+		{
+			tracks_[t].missed++;
+		}
+	}
+
+	// Tracks lost for too long go away; the rest keep their order
+	tracks_.erase(std::remove_if(tracks_.begin(), tracks_.end(),
+		[&](const Track& track) { return track.missed > maxMissed_; }), tracks_.end());
+
+	// Whatever is left over starts a new track
+	for (int b = 0; b < blobCount && static_cast<int>(tracks_.size()) < maxTracks_; b++)
+	{
+		if (blobMatched_[b])
+		{
+			continue;
+		}
+		Track track;
+		track.id = nextId_++;
+		track.position = blobs[b].centroid;
+		track.radius = blobs[b].radius;
+		track.classId = blobs[b].classId;
+		tracks_.push_back(track);
+	}
+
+	return tracks_;
+}
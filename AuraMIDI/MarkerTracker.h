@@ -0,0 +1,77 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <vector>
+
+#include "BlobExtractor.h"
+
+// One marker followed across frames.
+struct Track
+{
+	int id = 0;
+	cv::Point2f position; // Filtered
+	cv::Point2f velocity; // Filtered, pixels per second
+	float radius = 0;
+	int classId = 0;
+	int age = 0;    // Frames since the track was created
+	int missed = 0; // Consecutive frames without a matching blob
+
+	// Trigger state, owned by whoever plays the tiles
+	bool hasPlayed = false;
+	int armedZone = -1; // Zone a note was fired for ahead of the marker
+	std::chrono::steady_clock::time_point expectedEntry;
+};
+
+// Follows up to maxTracks blobs across frames and gives each a stable id.
+// Every track runs an alpha-beta filter (a steady-state Kalman filter for a
+// constant-velocity model) and predicts where it will be at the next frame's
+// timestamp. Blobs are matched to predictions greedily, nearest pair
+// first, among pairs closer than matchDistance. Blobs are sorted by x so
+// each track only looks at the blobs inside its gate: for N tracks and M
+// blobs, matching is O((N + M) log M) while markers stay further apart
+// than the gate, and O(NM log(NM)) at worst, when they crowd inside one
+// gate and every pair has to be sorted. All buffers are sized up front, so
+// update() never allocates.
+class MarkerTracker
+{
+public:
+	// alpha and beta weigh the measurement against the prediction for
+	// position and velocity respectively.
+	MarkerTracker(int maxTracks, float matchDistance, float alpha, float beta, int maxMissed = 5);
+
+	// Matches the blobs (largest first) of the frame captured at timestamp
+	// and returns the live tracks.
+	std::vector<Track>& update(const std::vector<Blob>& blobs, std::chrono::steady_clock::time_point timestamp);
+
+	std::vector<Track>& tracks();
+	const std::vector<Track>& tracks() const;
+
+	// Seconds between the last two frames.
+	float frameInterval() const;
+
+private:
+	struct Candidate
+	{
+		float distance2;
+		int track;
+		int blob;
+	};
+
+	int maxTracks_;
+	float matchDistance_;
+	float alpha_;
+	float beta_;
+	int maxMissed_;
+	int nextId_;
+	std::chrono::steady_clock::time_point lastTimestamp_;
+	bool hasTimestamp_;
+	float frameInterval_;
+
+	std::vector<Track> tracks_;
+	std::vector<cv::Point2f> predicted_;
+	std::vector<int> byX_;
+	std::vector<Candidate> candidates_;
+	std::vector<char> trackMatched_;
+	std::vector<char> blobMatched_;
+};
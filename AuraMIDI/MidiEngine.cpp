@@ -0,0 +1,359 @@
+#include "MidiEngine.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "ThreadPriority.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <timeapi.h>
+#endif
+
+// Events waiting in the timer wheel at most
+static const size_t scheduledCapacity = 4096;
+// How early delayed events go to a driver that can schedule them. JACK
+// places them within the period they fall in, so they have to arrive
+// before that period is processed; this covers 1024 frames at 48 kHz.
+static const uint64_t schedulingLeadMs = 5;
+static const uint64_t jackSchedulingLeadMs = 25;
+// Messages handed to the port in one call at most
+static const size_t batchCapacity = 256;
+
+MidiEvent MidiEvent::noteOn(int channel, int note, int velocity, uint32_t gateMs)
+{
+	MidiEvent event;
+	event.message[0] = static_cast<unsigned char>(0x90 | (channel & 0x0F));
+	event.message[1] = static_cast<unsigned char>(note & 0x7F);
+	event.message[2] = static_cast<unsigned char>(velocity & 0x7F);
+	event.size = 3;
+	event.gateMs = gateMs;
+	return event;
+}
+
+MidiEvent MidiEvent::noteOff(int channel, int note)
+{
+	MidiEvent event;
+	event.message[0] = static_cast<unsigned char>(0x80 | (channel & 0x0F));
+	event.message[1] = static_cast<unsigned char>(note & 0x7F);
+	event.message[2] = 0;
+	event.size = 3;
+	return event;
+}
+
+MidiEvent MidiEvent::controlChange(int channel, int controller, int value)
+{
+	MidiEvent event;
+	event.message[0] = static_cast<unsigned char>(0xB0 | (channel & 0x0F));
+	event.message[1] = static_cast<unsigned char>(controller & 0x7F);
+	event.message[2] = static_cast<unsigned char>(value & 0x7F);
+	event.size = 3;
+	return event;
+}
+
+MidiEvent MidiEvent::pitchBend(int channel, int value)
+{
+	MidiEvent event;
+	event.message[0] = static_cast<unsigned char>(0xE0 | (channel & 0x0F));
+	event.message[1] = static_cast<unsigned char>(value & 0x7F);
+	event.message[2] = static_cast<unsigned char>((value >> 7) & 0x7F);
+	event.size = 3;
+	return event;
+}
+
+MidiEngine::MidiEngine(RtMidiOut* midiout, size_t queueCapacity, OverflowPolicy policy, const ShaperConfig& shaper,
+	LatencyReport& latency)
+	: midiout_(midiout), queue_(queueCapacity, policy),
+	timed_{ { queueCapacity, OverflowPolicy::Block }, { queueCapacity, OverflowPolicy::Block }, { queueCapacity, policy } },
+	wheel_(scheduledCapacity), shaper_(shaper), latency_(latency), running_(false),
+	epoch_(std::chrono::steady_clock::now()), scheduling_(false), leadMs_(schedulingLeadMs), outputEpoch_(0.0),
+	batch_(batchCapacity), batchSize_(0), passUs_(0), sent_(0), retriggered_(0), unscheduled_(0)
+{
+	std::memset(sounding_, 0, sizeof(sounding_));
+	std::memset(generation_, 0, sizeof(generation_));
+	std::memset(kernelOffUs_, 0, sizeof(kernelOffUs_));
+}
+
+MidiEngine::~MidiEngine()
+{
+	stop();
+}
+
+void MidiEngine::start()
+{
+	if (running_)
+	{
+		return;
+	}
+	// Both clocks read together, so engine time maps onto output time
+	scheduling_ = midiout_ && midiout_->isSchedulingSupported();
+	leadMs_ = midiout_ && midiout_->getCurrentApi() == RtMidi::UNIX_JACK ? jackSchedulingLeadMs : schedulingLeadMs;
+	outputEpoch_ = scheduling_ ? midiout_->getOutputTime() : 0.0;
+	epoch_ = std::chrono::steady_clock::now();
+
+#ifdef _WIN32
+	// Windows wakes sleeping threads on a 15.6 ms tick by default, too
+	// coarse for this thread's 1 ms wheel and for the clock and sequencer
+	// threads timing their sends; WinMM cannot schedule output to make up
+	// for it
+	timeBeginPeriod(1);
+#endif
+	running_ = true;
+	thread_ = std::thread(&MidiEngine::run, this);
+	// Where the port cannot schedule, this thread's wake-ups are the timing
+	raiseThreadPriority(thread_);
+}
+
+void MidiEngine::stop()
+{
+	running_ = false;
+	if (thread_.joinable())
+	{
+		thread_.join();
+#ifdef _WIN32
+		timeEndPeriod(1);
+#endif
+	}
+}
+
+bool MidiEngine::send(const MidiEvent& event)
+{
+	MidiEvent copy = event;
+	return queue_.push(std::move(copy), running_);
+}
+
+bool MidiEngine::sendAt(TimedSource source, const MidiEvent& event, std::chrono::steady_clock::time_point at)
+{
+	// Anything already due goes out at once
+	const int64_t dueUs = std::chrono::duration_cast<std::chrono::microseconds>(at - epoch_).count();
+	Scheduled scheduled = { event, false, 0, static_cast<uint64_t>(std::max<int64_t>(dueUs, 0)) };
+	return timed_[static_cast<int>(source)].push(std::move(scheduled), running_);
+}
+
+uint32_t MidiEngine::leadMs() const
+{
+	// Plus a pass of the engine thread to pick it up
+	return scheduling_ ? static_cast<uint32_t>(leadMs_) + 2 : 0;
+}
+
+void MidiEngine::printStats(std::ostream& out) const
+{
+	out << "MIDI messages sent: " << sent_.load(std::memory_order_relaxed)
+		<< ", retriggered notes: " << retriggered_.load(std::memory_order_relaxed)
+		<< ", events dropped: " << queue_.dropped() + timed_[static_cast<int>(TimedSource::Pipeline)].dropped()
+			+ unscheduled_.load(std::memory_order_relaxed) << std::endl;
+	if (!running_)
+	{
+		shaper_.printStats(out);
+	}
+}
+
+uint64_t MidiEngine::nowUs() const
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch_).count();
+}
+
+void MidiEngine::run()
+{
+	while (running_)
+	{
+		service();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	// One more pass, so whatever was queued just before stop (the clock
+	// generator's Stop among it) still goes out if it is due
+	service();
+
+	// Close every gate still open, right now, including those already
+	// handed to the driver; other delayed events are dropped
+	wheel_.drain([this](const Scheduled& scheduled) {
+		if (scheduled.isGate)
+		{
+			closeGate(scheduled, false);
+		}
+	});
+	// Held notes have no gate to close; stop them too
+	const uint64_t nowUs = this->nowUs();
+	passUs_ = nowUs;
+	for (int channel = 0; channel < 16; channel++)
+	{
+		for (int note = 0; note < 128; note++)
+		{
+			if (sounding_[channel][note] || kernelOffUs_[channel][note] > nowUs)
+			{
+				write(MidiEvent::noteOff(channel, note), 0, false);
+				sounding_[channel][note] = false;
+				kernelOffUs_[channel][note] = 0;
+			}
+		}
+	}
+	flush();
+}
+
+void MidiEngine::service()
+{
+	const uint64_t nowUs = this->nowUs();
+	const uint64_t now = nowUs / 1000;
+	passUs_ = nowUs;
+	MidiEvent event;
+	while (queue_.tryPop(event))
+	{
+		if (event.delayMs == 0)
+		{
+			dispatch(event, nowUs, false);
+			continue;
+		}
+		Scheduled scheduled = { event, false, 0, nowUs + event.delayMs * 1000ull };
+		scheduled.event.delayMs = 0;
+		schedule(scheduled);
+	}
+	for (SpscQueue<Scheduled>& timed : timed_)
+	{
+		Scheduled scheduled;
+		while (timed.tryPop(scheduled))
+		{
+			if (scheduled.dueUs <= nowUs)
+			{
+				dispatch(scheduled.event, nowUs, false);
+				continue;
+			}
+			schedule(scheduled);
+		}
+	}
+
+	wheel_.advance(now, [this](const Scheduled& scheduled) { fire(scheduled); });
+	// Held controller values go after this pass's notes
+	batchSize_ += shaper_.release(now, &batch_[batchSize_], batch_.size() - batchSize_);
+	flush();
+}
+
+void MidiEngine::schedule(const Scheduled& scheduled)
+{
+	// With driver scheduling, wake up a little early and let the driver
+	// deliver at the exact time; without, fire on the nearest tick
+	uint64_t tick = (scheduled.dueUs + 500) / 1000;
+	if (scheduling_)
+	{
+		tick = tick > leadMs_ ? tick - leadMs_ : 0;
+	}
+	if (!wheel_.schedule(tick, scheduled))
+	{
+		unscheduled_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void MidiEngine::dispatch(const MidiEvent& event, uint64_t at, bool timed)
+{
+	const int status = event.message[0] & 0xF0;
+	const int channel = event.message[0] & 0x0F;
+	const int note = event.message[1] & 0x7F;
+
+	if (event.size == 3 && status == 0x90 && event.message[2] > 0)
+	{
+		// A Note Off for this note may already sit in the driver; start
+		// after it, or it would cut the new note short
+		uint64_t start = at;
+		if (kernelOffUs_[channel][note] > start)
+		{
+			start = kernelOffUs_[channel][note];
+			timed = true;
+		}
+
+		if (sounding_[channel][note])
+		{
+			// Restart rather than stack the same note
+			write(MidiEvent::noteOff(channel, note), start, timed);
+			retriggered_.fetch_add(1, std::memory_order_relaxed);
+		}
+		sounding_[channel][note] = true;
+		generation_[channel][note]++;
+		write(event, start, timed);
+
+		if (event.gateMs > 0)
+		{
+			Scheduled off = { MidiEvent::noteOff(channel, note), true, generation_[channel][note], start + event.gateMs * 1000ull };
+			schedule(off);
+		}
+		return;
+	}
+
+	if (event.size == 3 && (status == 0x80 || status == 0x90))
+	{
+		sounding_[channel][note] = false;
+	}
+	write(event, at, timed);
+}
+
+void MidiEngine::fire(const Scheduled& scheduled)
+{
+	if (scheduled.isGate)
+	{
+		closeGate(scheduled, true);
+	}
+	else
+	{
+		dispatch(scheduled.event, scheduled.dueUs, true);
+	}
+}
+
+void MidiEngine::closeGate(const Scheduled& scheduled, bool timed)
+{
+	const int channel = scheduled.event.message[0] & 0x0F;
+	const int note = scheduled.event.message[1] & 0x7F;
+	// The note was stopped or played again since; this gate is stale
+	if (!sounding_[channel][note] || generation_[channel][note] != scheduled.generation)
+	{
+		return;
+	}
+	sounding_[channel][note] = false;
+	if (timed && scheduling_)
+	{
+		kernelOffUs_[channel][note] = scheduled.dueUs;
+	}
+	write(scheduled.event, scheduled.dueUs, timed);
+}
+
+void MidiEngine::write(const MidiEvent& event, uint64_t at, bool timed)
+{
+	if (batchSize_ == batch_.size())
+	{
+		flush();
+	}
+	RtMidiShortMessage& message = batch_[batchSize_];
+	std::memcpy(message.bytes, event.message, sizeof(message.bytes));
+	message.size = event.size;
+	message.timestamp = timed && scheduling_ ? outputEpoch_ + at / 1000000.0 : -1.0;
+	if (shaper_.admit(message))
+	{
+		shaper_.account(message, passUs_ / 1000);
+		batchSize_++;
+		if (event.captured.time_since_epoch().count() != 0)
+		{
+			// Leaves now, or at its timestamp when the driver holds it
+			latency_.record(LatencyStage::MidiOut, event.captured,
+				epoch_ + std::chrono::microseconds(timed && scheduling_ ? at : passUs_));
+		}
+	}
+}
+
+void MidiEngine::flush()
+{
+	if (batchSize_ == 0)
+	{
+		return;
+	}
+	try
+	{
+		if (midiout_)
+		{
+			midiout_->sendMessages(batch_.data(), batchSize_);
+		}
+		sent_.fetch_add(batchSize_, std::memory_order_relaxed);
+	}
+	catch (RtMidiError& error)
+	{
+		error.printMessage();
+	}
+	batchSize_ = 0;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include <RtMidi.h>
+
+#include "Latency.h"
+#include "MidiShaper.h"
+#include "SpscQueue.h"
+#include "TimerWheel.h"
+
+// One short MIDI message plus when to send it. Fixed size, so the queue and
+// the timer wheel can hold it by value.
+struct MidiEvent
+{
+	unsigned char message[3] = { 0, 0, 0 };
+	unsigned char size = 0;
+	uint32_t delayMs = 0; // Send this long after it was queued
+	uint32_t gateMs = 0;  // For a Note On: send the matching Note Off this long after it
+	// For a Note On played from a camera frame: when that frame entered
+	// the pipeline, for the latency report
+	std::chrono::steady_clock::time_point captured;
+
+	static MidiEvent noteOn(int channel, int note, int velocity, uint32_t gateMs);
+	static MidiEvent noteOff(int channel, int note);
+	static MidiEvent controlChange(int channel, int controller, int value);
+	static MidiEvent pitchBend(int channel, int value); // 0..16383, 8192 centred
+};
+
+// Threads that send events at an absolute time, each with its own queue.
+enum class TimedSource
+{
+	Sequencer,
+	Clock,
+	Pipeline
+};
+
+// Owns all MIDI output. Other threads hand events over through a lock-free
+// queue and never wait on the port; the engine thread sends them and keeps
+// everything delayed (note-offs, scheduled events) in a timer wheel with a
+// 1 ms tick. A note played again before its gate has closed is stopped and
+// restarted, and its earlier note-off is dropped so it cannot cut the new
+// note short. On stop, every note still sounding is stopped, held ones
+// (no gate) included, so no note hangs.
+//
+// When the port can schedule output (RtMidiOut::isSchedulingSupported),
+// delayed events leave the wheel a few milliseconds early and go to the
+// driver with their exact due time, so their timing no longer depends on
+// when this thread wakes up.
+//
+// Everything due in one pass of the engine thread (a chord, several
+// markers landing in the same frame, a burst of controllers) reaches the
+// port as one batch. Before that, a MidiShaper keeps controller traffic
+// within the link's byte budget without ever holding back a note.
+//
+// Further queues take events with an absolute due time, one per timed
+// source (the sequencer, the clock generator, notes the pipeline moves
+// onto the clock's grid), which queue them ahead of time. Due times are
+// kept to the microsecond, so with driver scheduling such events go out
+// exactly when due.
+class MidiEngine
+{
+public:
+	// With no port (midiout null), everything is shaped and counted as if
+	// sent, then dropped; the bench replays clips that way.
+	MidiEngine(RtMidiOut* midiout, size_t queueCapacity, OverflowPolicy policy, const ShaperConfig& shaper,
+		LatencyReport& latency);
+	~MidiEngine();
+
+	MidiEngine(const MidiEngine&) = delete;
+	MidiEngine& operator=(const MidiEngine&) = delete;
+
+	// On Windows, the system timer runs at 1 ms from start() to stop(), for
+	// this thread and every other one timing MIDI output.
+	void start();
+	void stop();
+
+	// Producer side, for a single thread. Returns false if the engine is
+	// not running.
+	bool send(const MidiEvent& event);
+
+	// Producer side of source's queue, for one thread per source: sends
+	// event at time at. Call only while the engine is running.
+	bool sendAt(TimedSource source, const MidiEvent& event, std::chrono::steady_clock::time_point at);
+
+	// How long before it is due a timed event has to be sent for the port
+	// to deliver it exactly, or 0 if the port cannot schedule. Valid once
+	// started.
+	uint32_t leadMs() const;
+
+	void printStats(std::ostream& out) const;
+
+private:
+	struct Scheduled
+	{
+		MidiEvent event;
+		bool isGate;         // The Note Off closing a gate
+		uint32_t generation; // Of the Note On that gate belongs to
+		uint64_t dueUs;      // Engine time, in microseconds
+	};
+
+	static const int timedSourceCount = 3;
+
+	void run();
+	// One pass of the engine thread: takes everything queued, fires what
+	// is due and sends it
+	void service();
+	uint64_t nowUs() const;
+	void schedule(const Scheduled& scheduled);
+	// timed: send at engine time at (in microseconds) rather than right away
+	void dispatch(const MidiEvent& event, uint64_t at, bool timed);
+	void fire(const Scheduled& scheduled);
+	void closeGate(const Scheduled& scheduled, bool timed);
+	void write(const MidiEvent& event, uint64_t at, bool timed);
+	void flush();
+
+	RtMidiOut* midiout_;
+	SpscQueue<MidiEvent> queue_;
+	SpscQueue<Scheduled> timed_[timedSourceCount];
+	TimerWheel<Scheduled> wheel_;
+	MidiShaper shaper_;
+	LatencyReport& latency_;
+
+	std::atomic<bool> running_;
+	std::thread thread_;
+	std::chrono::steady_clock::time_point epoch_;
+	bool scheduling_;    // The port holds timestamped messages until due
+	uint64_t leadMs_;    // How early delayed events go to the port
+	double outputEpoch_; // Output clock at epoch_, in seconds
+
+	// Per channel and note: sounding or not, and which Note On it was
+	bool sounding_[16][128];
+	uint32_t generation_[16][128];
+	// Due time (in microseconds) of a Note Off already handed to the driver
+	uint64_t kernelOffUs_[16][128];
+
+	// Messages written since the last flush, sent to the port in one call
+	std::vector<RtMidiShortMessage> batch_;
+	size_t batchSize_;
+	uint64_t passUs_; // When the current pass of the engine thread began
+
+	std::atomic<uint64_t> sent_;
+	std::atomic<uint64_t> retriggered_;
+	std::atomic<uint64_t> unscheduled_; // Timer wheel full
+};
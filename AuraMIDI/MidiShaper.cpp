@@ -0,0 +1,267 @@
+#include "MidiShaper.h"
+
+#include <algorithm>
+
+// How much unused budget builds up while the link is idle
+static const int burstMs = 20;
+
+ShaperConfig ShaperConfig::fromJson(const Json::Value& value)
+{
+	ShaperConfig config;
+	if (!value.isObject())
+	{
+		return config;
+	}
+	config.bytesPerSecond = std::max(0, value.get("bytesPerSecond", config.bytesPerSecond).asInt());
+	config.coalesceMs = std::max(0, value.get("coalesceMs", config.coalesceMs).asInt());
+	config.runningStatus = value.get("runningStatus", config.runningStatus).asBool();
+	return config;
+}
+
+MidiShaper::MidiShaper(const ShaperConfig& config)
+	: config_(config), lanes_(slotCount), dirty_(slotCount, false), held_(0), cursor_(0),
+	credit_(0), refilledMs_(0), lastStatus_(0), bytes_(0), coalesced_(0), suppressed_(0),
+	firstMs_(0), lastMs_(0), windowStartMs_(0), windowBytes_(0), peakRate_(0)
+{
+	// Room for at least one message of each kind, however small the budget
+	maxCredit_ = std::max<int64_t>(static_cast<int64_t>(config_.bytesPerSecond) * burstMs, 3000);
+	credit_ = maxCredit_;
+}
+
+bool MidiShaper::admit(RtMidiShortMessage& message)
+{
+	const int status = message.bytes[0] & 0xF0;
+	const int channel = message.bytes[0] & 0x0F;
+	if (config_.runningStatus && status == 0x80 && message.size == 3 && message.bytes[2] == 0)
+	{
+		// Same status byte as the Note Ons around it
+		message.bytes[0] = static_cast<unsigned char>(0x90 | channel);
+		return true;
+	}
+	// Timed messages already sit in the driver's schedule
+	if (message.timestamp >= 0.0)
+	{
+		return true;
+	}
+
+	int slot;
+	int value;
+	if (status == 0xB0 && message.size == 3)
+	{
+		const int controller = message.bytes[1] & 0x7F;
+		value = message.bytes[2] & 0x7F;
+		if (controller >= 32 && controller < 64)
+		{
+			// The fine half of a 14-bit pair shares its coarse half's lane;
+			// without a coarse value to send ahead of it, it goes as it is
+			slot = channel * 128 + controller - 32;
+			Lane& coarse = lanes_[slot];
+			if (coarse.pending < 0)
+			{
+				return true;
+			}
+			if (!coarse.paired)
+			{
+				coarse.paired = true;
+				coarse.pending <<= 7;
+				coarse.sent = -1;
+			}
+			value |= coarse.pending & ~0x7F;
+		}
+		else
+		{
+			slot = channel * 128 + controller;
+			if (controller < 32 && lanes_[slot].paired)
+			{
+				value = value << 7 | (lanes_[slot].pending & 0x7F);
+			}
+		}
+	}
+	else if (status == 0xD0 && message.size == 2)
+	{
+		slot = pressureSlot + channel;
+		value = message.bytes[1] & 0x7F;
+	}
+	else if (status == 0xE0 && message.size == 3)
+	{
+		slot = pitchBendSlot + channel;
+		value = (message.bytes[2] & 0x7F) << 7 | (message.bytes[1] & 0x7F);
+	}
+	else
+	{
+		return true;
+	}
+
+	Lane& lane = lanes_[slot];
+	if (dirty_[slot])
+	{
+		coalesced_++;
+	}
+	else if (value == lane.sent)
+	{
+		suppressed_++;
+		return false;
+	}
+	else
+	{
+		dirty_[slot] = true;
+		held_++;
+	}
+	lane.pending = value;
+	return false;
+}
+
+void MidiShaper::account(const RtMidiShortMessage& message, uint64_t nowMs)
+{
+	refill(nowMs);
+	const size_t size = wireBytes(message);
+	credit_ -= static_cast<int64_t>(size) * 1000;
+	bytes_ += size;
+
+	const unsigned char status = message.bytes[0];
+	if (status < 0xF0)
+	{
+		lastStatus_ = status;
+	}
+	else if (status < 0xF8)
+	{
+		// System common messages cancel running status; real-time ones
+		// leave it alone
+		lastStatus_ = 0;
+	}
+
+	if (bytes_ == size)
+	{
+		firstMs_ = nowMs;
+		windowStartMs_ = nowMs;
+	}
+	lastMs_ = nowMs;
+	// Busiest whole second
+	if (nowMs >= windowStartMs_ + 1000)
+	{
+		peakRate_ = std::max(peakRate_, windowBytes_ * 1000 / (nowMs - windowStartMs_));
+		windowStartMs_ = nowMs;
+		windowBytes_ = 0;
+	}
+	windowBytes_ += size;
+}
+
+size_t MidiShaper::release(uint64_t nowMs, RtMidiShortMessage* out, size_t capacity)
+{
+	if (held_ == 0)
+	{
+		return 0;
+	}
+	refill(nowMs);
+
+	size_t count = 0;
+	const int start = cursor_;
+	for (int i = 0; i < slotCount && held_ > 0; i++)
+	{
+		// Start after the last lane served, so no lane starves when the
+		// budget runs short
+		const int slot = (start + i) % slotCount;
+		if (!dirty_[slot] || nowMs < lanes_[slot].nextMs)
+		{
+			continue;
+		}
+		Lane& lane = lanes_[slot];
+		if (lane.pending == lane.sent)
+		{
+			dirty_[slot] = false;
+			held_--;
+			suppressed_++;
+			continue;
+		}
+
+		// A 14-bit pair goes out whole, coarse half first: receivers clear
+		// the fine half when the coarse one arrives
+		RtMidiShortMessage message = encode(slot, lane.paired ? lane.pending >> 7 : lane.pending);
+		RtMidiShortMessage fine = {};
+		size_t messages = 1;
+		size_t size = wireBytes(message);
+		if (lane.paired)
+		{
+			fine = encode(slot + 32, lane.pending & 0x7F);
+			messages = 2;
+			size += config_.runningStatus ? fine.size - 1 : fine.size;
+		}
+		if (count + messages > capacity
+			|| (config_.bytesPerSecond > 0 && credit_ < static_cast<int64_t>(size) * 1000))
+		{
+			break;
+		}
+		account(message, nowMs);
+		out[count++] = message;
+		if (lane.paired)
+		{
+			account(fine, nowMs);
+			out[count++] = fine;
+		}
+		lane.sent = lane.pending;
+		lane.nextMs = nowMs + config_.coalesceMs;
+		dirty_[slot] = false;
+		held_--;
+		cursor_ = (slot + 1) % slotCount;
+	}
+	return count;
+}
+
+void MidiShaper::printStats(std::ostream& out) const
+{
+	const uint64_t averageRate = lastMs_ > firstMs_ ? bytes_ * 1000 / (lastMs_ - firstMs_) : bytes_;
+	out << "MIDI output: " << bytes_ << " bytes, " << averageRate << " bytes/s on average, "
+		<< std::max(peakRate_, averageRate) << " at peak";
+	if (config_.bytesPerSecond > 0)
+	{
+		out << " of " << config_.bytesPerSecond << " budgeted";
+	}
+	out << ", controller values coalesced: " << coalesced_ << ", unchanged values skipped: " << suppressed_ << std::endl;
+}
+
+RtMidiShortMessage MidiShaper::encode(int slot, int value)
+{
+	RtMidiShortMessage message;
+	message.timestamp = -1.0;
+	if (slot < pressureSlot)
+	{
+		message.bytes[0] = static_cast<unsigned char>(0xB0 | slot / 128);
+		message.bytes[1] = static_cast<unsigned char>(slot % 128);
+		message.bytes[2] = static_cast<unsigned char>(value);
+		message.size = 3;
+	}
+	else if (slot < pitchBendSlot)
+	{
+		message.bytes[0] = static_cast<unsigned char>(0xD0 | (slot - pressureSlot));
+		message.bytes[1] = static_cast<unsigned char>(value);
+		message.bytes[2] = 0;
+		message.size = 2;
+	}
+	else
+	{
+		message.bytes[0] = static_cast<unsigned char>(0xE0 | (slot - pitchBendSlot));
+		message.bytes[1] = static_cast<unsigned char>(value & 0x7F);
+		message.bytes[2] = static_cast<unsigned char>(value >> 7);
+		message.size = 3;
+	}
+	return message;
+}
+
+size_t MidiShaper::wireBytes(const RtMidiShortMessage& message) const
+{
+	if (config_.runningStatus && message.bytes[0] < 0xF0 && message.bytes[0] == lastStatus_)
+	{
+		return message.size - 1;
+	}
+	return message.size;
+}
+
+void MidiShaper::refill(uint64_t nowMs)
+{
+	if (nowMs <= refilledMs_)
+	{
+		return;
+	}
+	credit_ = std::min(maxCredit_, credit_ + static_cast<int64_t>(nowMs - refilledMs_) * config_.bytesPerSecond);
+	refilledMs_ = nowMs;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <json/json.h>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <RtMidi.h>
+
+// Output budget of the MIDI link. The default is what a 5-pin DIN cable
+// carries: 31250 baud at 10 bits per byte.
+struct ShaperConfig
+{
+	int bytesPerSecond = 3125; // 0 for no limit
+	int coalesceMs = 10;       // Each controller is sent at most once per this many ms
+	bool runningStatus = true; // The link drops repeated status bytes (DIN through ALSA does)
+
+	// Reads the optional "midiOutput" object of the "pipeline" settings, e.g.
+	// "midiOutput": { "bytesPerSecond": 3125, "coalesceMs": 10, "runningStatus": true }
+	static ShaperConfig fromJson(const Json::Value& value);
+};
+
+// Keeps continuous controller traffic within what the MIDI link carries.
+// Notes and every other message go straight through; controller changes,
+// pitch bend and channel pressure are held per channel and controller,
+// newer values replacing older ones, and go out at most once per
+// coalescing window, only if they differ from the last value sent, and
+// only while the byte budget allows. A 14-bit controller pair (0-31 with
+// 32-63) is one lane holding both halves, sent coarse half first and
+// skipped only if neither half changed. Held values go out grouped by
+// status byte so a link with running status sends fewer bytes, and with
+// running status on, Note Off is sent as Note On with velocity 0 for the
+// same reason.
+//
+// Used by the MIDI engine thread only; read the statistics once it has
+// stopped.
+class MidiShaper
+{
+public:
+	explicit MidiShaper(const ShaperConfig& config);
+
+	// Takes a message about to be sent. Returns false if it was held back
+	// or dropped; otherwise message may have been re-encoded and must be
+	// sent. Timed messages are never held.
+	bool admit(RtMidiShortMessage& message);
+
+	// Counts a message against the budget as it is sent.
+	void account(const RtMidiShortMessage& message, uint64_t nowMs);
+
+	// Writes held values due now into out, up to capacity of them and
+	// while the budget lasts, and returns how many.
+	size_t release(uint64_t nowMs, RtMidiShortMessage* out, size_t capacity);
+
+	void printStats(std::ostream& out) const;
+
+private:
+	// One lane per channel and controller, then per channel for channel
+	// pressure and for pitch bend: in status byte order
+	static const int pressureSlot = 16 * 128;
+	static const int pitchBendSlot = pressureSlot + 16;
+	static const int slotCount = pitchBendSlot + 16;
+
+	struct Lane
+	{
+		int pending = -1; // Latest value asked for
+		int sent = -1;    // Last value sent, -1 before the first
+		uint64_t nextMs = 0;
+		bool paired = false; // A controller 0-31 whose fine half has been seen: values are 14-bit
+	};
+
+	static RtMidiShortMessage encode(int slot, int value);
+	size_t wireBytes(const RtMidiShortMessage& message) const;
+	void refill(uint64_t nowMs);
+
+	ShaperConfig config_;
+	std::vector<Lane> lanes_;
+	std::vector<bool> dirty_; // Lanes holding a value
+	size_t held_;             // How many
+	int cursor_;
+
+	// Budget, in thousandths of a byte so no rounding builds up
+	int64_t credit_;
+	int64_t maxCredit_;
+	uint64_t refilledMs_;
+	unsigned char lastStatus_; // For running status; 0 when there is none
+
+	// Statistics
+	uint64_t bytes_;
+	uint64_t coalesced_;
+	uint64_t suppressed_;
+	uint64_t firstMs_;
+	uint64_t lastMs_;
+	uint64_t windowStartMs_;
+	uint64_t windowBytes_;
+	uint64_t peakRate_; // Bytes per second
+};
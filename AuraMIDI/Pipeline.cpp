@@ -0,0 +1,418 @@
+#include "Pipeline.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+// Lights zone index; clearing first idles every other zone of its type.
+static void lightZone(const TileLayout& layout, std::vector<ZoneState>& zoneState, int index, bool clear)
+{
+	const Zone& zone = layout.zone(index);
+	if (clear)
+	{
+		for (int i = 0; i < layout.zoneCount(); i++)
+		{
+			if (i != index && layout.zone(i).type == zone.type)
+			{
+				zoneState[i] = ZoneState::Idle;
+			}
+		}
+	}
+	zoneState[index] = zone.mute ? ZoneState::Muted : ZoneState::Active;
+}
+
+static QueueConfig queueFromJson(const Json::Value& value, QueueConfig fallback)
+{
+	if (!value.isObject())
+	{
+		return fallback;
+	}
+	if (value.isMember("capacity"))
+	{
+		fallback.capacity = value["capacity"].asUInt();
+	}
+	if (value.isMember("policy"))
+	{
+		std::string policy = value["policy"].asString();
+		if (policy == "block")
+		{
+			fallback.policy = OverflowPolicy::Block;
+		}
+		else if (policy == "drop-oldest")
+		{
+			fallback.policy = OverflowPolicy::DropOldest;
+		}
+		else
+		{
+			std::cout << "Unknown queue policy \"" << policy << "\", keeping the default" << std::endl;
+		}
+	}
+	return fallback;
+}
+
+PipelineConfig PipelineConfig::fromJson(const Json::Value& data)
+{
+	PipelineConfig config;
+	const Json::Value& pipeline = data["pipeline"];
+	config.segmentToTrack = queueFromJson(pipeline["segmentToTrack"], config.segmentToTrack);
+	config.trackToRender = queueFromJson(pipeline["trackToRender"], config.trackToRender);
+	config.midiEvents = queueFromJson(pipeline["midiEvents"], config.midiEvents);
+	config.midiOutput = ShaperConfig::fromJson(pipeline["midiOutput"]);
+	config.erodeSize = pipeline.get("erodeSize", config.erodeSize).asInt();
+	config.dilateSize = pipeline.get("dilateSize", config.dilateSize).asInt();
+	config.minBlobArea = pipeline.get("minBlobArea", config.minBlobArea).asInt();
+	config.maxMarkers = pipeline.get("maxMarkers", config.maxMarkers).asInt();
+	config.matchDistance = pipeline.get("matchDistance", config.matchDistance).asFloat();
+	config.trackerAlpha = pipeline.get("trackerAlpha", config.trackerAlpha).asFloat();
+	config.trackerBeta = pipeline.get("trackerBeta", config.trackerBeta).asFloat();
+	config.latencyMs = pipeline.get("latencyMs", config.latencyMs).asFloat();
+	config.fullVelocitySpeed = pipeline.get("fullVelocitySpeed", config.fullVelocitySpeed).asFloat();
+	config.clockInput = pipeline.get("clockInput", config.clockInput).asInt();
+	config.quantise = pipeline.get("quantise", config.quantise).asInt();
+	config.tempo = TempoConfig::fromJson(pipeline["tempo"]);
+	config.sequencer = SequencerConfig::fromJson(pipeline["sequencer"]);
+	config.camera = CameraConfig::fromJson(pipeline["camera"]);
+	config.record = RecordConfig::fromJson(pipeline["record"]);
+	// The grid has to be a whole number of clocks, 96 to the bar
+	if (config.quantise < 0 || (config.quantise > 0 && 96 % config.quantise != 0))
+	{
+		std::cout << "Cannot quantise to 1/" << config.quantise << ", playing notes as they come" << std::endl;
+		config.quantise = 0;
+	}
+	return config;
+}
+
+FramePipeline::FramePipeline(FrameCapture& capture, ColourClassifier& classifier, const TileLayout& layout, MidiEngine& midi,
+	ClockSync& clock, ClockGenerator& tempo, Sequencer& sequencer, LatencyReport& latency, const PipelineConfig& config)
+	: capture_(capture), classifier_(classifier), layout_(layout), midi_(midi), clock_(clock), tempo_(tempo),
+	sequencer_(sequencer), latency_(latency),
+	quantiseTicks_(config.quantise > 0 ? 96 / config.quantise : 0),
+	morphology_(config.erodeSize, config.dilateSize),
+	segmentToTrack_(config.segmentToTrack.capacity, config.segmentToTrack.policy),
+	trackToRender_(config.trackToRender.capacity, config.trackToRender.policy),
+	running_(false), blobExtractor_(config.minBlobArea),
+	tracker_(config.maxMarkers, config.matchDistance, config.trackerAlpha, config.trackerBeta),
+	predictor_(config.latencyMs, config.fullVelocitySpeed), controllers_(layout), track_(80),
+	zoneState_(layout.zoneCount(), ZoneState::Idle)
+{
+	held_.reserve(config.maxMarkers);
+}
+
+FramePipeline::~FramePipeline()
+{
+	stop();
+}
+
+void FramePipeline::start()
+{
+	if (running_)
+	{
+		return;
+	}
+	running_ = true;
+	capture_.start();
+	segmentThread_ = std::thread(&FramePipeline::segmentStage, this);
+	trackThread_ = std::thread(&FramePipeline::trackStage, this);
+}
+
+void FramePipeline::stop()
+{
+	running_ = false;
+	for (std::thread* stage : { &segmentThread_, &trackThread_ })
+	{
+		if (stage->joinable())
+		{
+			stage->join();
+		}
+	}
+	capture_.stop();
+}
+
+bool FramePipeline::nextFrame(FrameContext& frame)
+{
+	if (!trackToRender_.tryPop(frame))
+	{
+		return false;
+	}
+	// Only the newest frame is worth showing
+	while (trackToRender_.tryPop(frame))
+	{
+	}
+	return true;
+}
+
+void FramePipeline::printStats(std::ostream& out) const
+{
+	out << "Captured " << capture_.capturedFrames() << " frames, dropped " << capture_.droppedFrames() << " stale frames\n";
+	out << "Dropped before tracking: " << segmentToTrack_.dropped()
+		<< ", before render: " << trackToRender_.dropped() << std::endl;
+	predictor_.printStats(out);
+}
+
+void FramePipeline::segmentStage()
+{
+	unsigned spins = 0;
+
+	while (running_)
+	{
+		if (!capture_.acquire())
+		{
+			backoff(spins);
+			continue;
+		}
+		spins = 0;
+
+		const CapturedFrame& captured = capture_.frame();
+		FrameContext frame;
+		frame.arrived = captured.timestamp;
+		segmentFrame(captured, frame);
+		segmentToTrack_.push(std::move(frame), running_);
+	}
+}
+
+void FramePipeline::segmentFrame(const CapturedFrame& captured, FrameContext& frame)
+{
+	frame.sequence = captured.sequence;
+	frame.timestamp = captured.timestamp;
+
+	// One table lookup per pixel labels every marker colour at once, on
+	// the camera's own pixels; mirroring the labels afterwards moves a
+	// byte per pixel rather than a whole colour image
+	classifier_.classify(captured.image, captured.format, labels_);
+	cv::flip(labels_, frame.labels, 1);
+	// The capture buffer goes back to the camera, so the preview keeps a copy
+	captured.image.copyTo(frame.image);
+	frame.format = captured.format;
+
+	// Pack, erode and dilate in one go on the 1-bit mask
+	morphology_.apply(frame.labels, frame.bits);
+	latency_.record(LatencyStage::Segmented, frame.arrived);
+}
+
+void FramePipeline::trackStage()
+{
+	FrameContext frame;
+	while (segmentToTrack_.pop(frame, running_))
+	{
+		trackFrame(frame);
+		sendFrame(frame, false);
+		trackToRender_.push(std::move(frame), running_);
+	}
+}
+
+size_t FramePipeline::process(const CapturedFrame& captured, FrameContext& frame, bool keepMidi)
+{
+	frame.arrived = std::chrono::steady_clock::now();
+	segmentFrame(captured, frame);
+	trackFrame(frame);
+	return sendFrame(frame, keepMidi);
+}
+
+size_t FramePipeline::sendFrame(FrameContext& frame, bool keepMidi)
+{
+	// On a running clock, notes wait for the next grid point; the engine
+	// gets that point as an absolute time, so nothing shifts it
+	bool quantised = false;
+	std::chrono::steady_clock::time_point at;
+	if (quantiseTicks_ > 0 && !frame.notes.empty())
+	{
+		const auto now = std::chrono::steady_clock::now();
+		quantised = clock_.state().nextGridPoint(now, quantiseTicks_, at) && at > now;
+	}
+
+	// Hand the notes over; the engine does the waiting
+	frame.midi.clear();
+	for (const NoteEvent& event : frame.notes)
+	{
+		MidiEvent note = event.velocity > 0 ? MidiEvent::noteOn(0, event.note, event.velocity, event.gateMs)
+			: MidiEvent::noteOff(0, event.note);
+		if (event.velocity > 0)
+		{
+			// Only Note Ons are timed; a release is not a hit
+			note.captured = frame.arrived;
+		}
+		if (quantised)
+		{
+			midi_.sendAt(TimedSource::Pipeline, note, at);
+		}
+		else
+		{
+			midi_.send(note);
+		}
+		if (keepMidi)
+		{
+			frame.midi.push_back(note);
+		}
+	}
+	for (const MidiEvent& event : controllers_.events())
+	{
+		midi_.send(event);
+	}
+	if (keepMidi)
+	{
+		frame.midi.insert(frame.midi.end(), controllers_.events().begin(), controllers_.events().end());
+	}
+	return frame.notes.size() + controllers_.events().size();
+}
+
+// Note a playable zone sends with track selected.
+static int zoneNote(const Zone& zone, int track)
+{
+	return zone.type == ZoneType::Pattern ? track + zone.note : zone.note;
+}
+
+void FramePipeline::playZone(FrameContext& frame, const Track& marker, int index)
+{
+	const Zone& zone = layout_.zone(index);
+	const int note = zoneNote(zone, track_);
+	frame.notes.push_back({ note, predictor_.velocityFor(marker), zone.gateMs });
+	if (zone.gateMs == 0 && held_.size() < held_.capacity())
+	{
+		held_.push_back({ marker.id, index, note });
+	}
+}
+
+void FramePipeline::releaseHeld(FrameContext& frame, const std::vector<Track>& tracks)
+{
+	for (size_t i = 0; i < held_.size();)
+	{
+		const HeldNote& held = held_[i];
+		auto marker = std::find_if(tracks.begin(), tracks.end(), [&](const Track& track) { return track.id == held.trackId; });
+		// Kept while the marker is in the zone, on its way there after a
+		// note fired ahead of it, or briefly out of sight
+		if (marker != tracks.end() && (marker->missed > 0 || marker->armedZone == held.zone
+			|| layout_.zoneAt(marker->position) == held.zone))
+		{
+			i++;
+			continue;
+		}
+		frame.notes.push_back({ held.note, 0, 0 });
+		held_[i] = held_.back();
+		held_.pop_back();
+	}
+}
+
+void FramePipeline::trackFrame(FrameContext& frame)
+{
+	// Label the mask in one pass, then follow every marker
+	frame.blobs = blobExtractor_.extract(frame.bits, frame.labels);
+	latency_.record(LatencyStage::Blobs, frame.arrived);
+	std::vector<Track>& tracks = tracker_.update(frame.blobs, frame.timestamp);
+	predictor_.beginFrame(frame.timestamp, tracker_.frameInterval());
+
+	frame.tracks.clear();
+	frame.notes.clear();
+	// Releases go first, so a zone left for one with the same note plays it
+	releaseHeld(frame, tracks);
+	controllers_.beginFrame();
+	// The first hit of a frame clears its zone type, later ones add to it
+	bool lit[static_cast<int>(ZoneType::Count)] = {};
+
+	for (Track& marker : tracks)
+	{
+		if (marker.missed > 0)
+		{
+			continue;
+		}
+		frame.tracks.push_back(marker);
+
+		// One lookup, whatever the number of zones
+		int index = layout_.zoneAt(marker.position);
+		if (index >= 0 && layout_.zone(index).type == ZoneType::XYPad)
+		{
+			controllers_.update(marker, index);
+			bool& padLit = lit[static_cast<int>(ZoneType::XYPad)];
+			lightZone(layout_, zoneState_, index, !padLit);
+			padLit = true;
+			// Plays no notes, so for those the marker is on open ground
+			index = -1;
+		}
+		if (index < 0)
+		{
+			if (marker.armedZone >= 0)
+			{
+				// Fired ahead of a hit that has not come (yet)
+				if (predictor_.expired(marker.expectedEntry, frame.timestamp))
+				{
+					predictor_.observeFalseTrigger();
+					marker.armedZone = -1;
+					marker.hasPlayed = false;
+				}
+				continue;
+			}
+
+			marker.hasPlayed = false;
+
+			float seconds = 0;
+			int target = predictor_.predict(marker, layout_, seconds);
+			if (target >= 0)
+			{
+				playZone(frame, marker, target);
+				marker.hasPlayed = true;
+				marker.armedZone = target;
+				marker.expectedEntry = frame.timestamp
+					+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(seconds));
+			}
+			continue;
+		}
+
+		const Zone& zone = layout_.zone(index);
+		bool& typeLit = lit[static_cast<int>(zone.type)];
+		lightZone(layout_, zoneState_, index, !typeLit);
+		typeLit = true;
+
+		if (zone.type == ZoneType::Track)
+		{
+			track_ = zone.note;
+			continue;
+		}
+
+		if (zone.sequenced || zone.type == ZoneType::Tempo)
+		{
+			// Once per visit: a tap, or a launch or mute for the next bar
+			if (marker.armedZone >= 0 || marker.hasPlayed == false)
+			{
+				if (marker.armedZone >= 0)
+				{
+					predictor_.observeFalseTrigger();
+				}
+				if (zone.type == ZoneType::Tempo)
+				{
+					tempo_.tap(frame.timestamp);
+				}
+				else if (zone.mute)
+				{
+					sequencer_.toggleMute(track_);
+				}
+				else
+				{
+					sequencer_.launch(track_, index);
+				}
+			}
+			marker.armedZone = -1;
+			marker.hasPlayed = true;
+			continue;
+		}
+
+		if (marker.armedZone == index)
+		{
+			// Already played ahead of time; see how good the guess was
+			predictor_.observeEntry(marker.expectedEntry, frame.timestamp);
+		}
+		else if (marker.armedZone >= 0 || marker.hasPlayed == false)
+		{
+			// Predicted the wrong zone, or nothing at all: play it now
+			if (marker.armedZone >= 0)
+			{
+				predictor_.observeFalseTrigger();
+			}
+			predictor_.observeLateHit();
+			playZone(frame, marker, index);
+		}
+		marker.armedZone = -1;
+		marker.hasPlayed = true;
+	}
+
+	frame.zoneState = zoneState_;
+	latency_.record(LatencyStage::Decided, frame.arrived);
+}
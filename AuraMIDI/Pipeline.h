@@ -0,0 +1,201 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "BitMask.h"
+#include "BlobExtractor.h"
+#include "ClockGenerator.h"
+#include "ClockSync.h"
+#include "ColourClassifier.h"
+#include "ControllerMap.h"
+#include "FrameCapture.h"
+#include "HitPredictor.h"
+#include "Latency.h"
+#include "MidiEngine.h"
+#include "MarkerTracker.h"
+#include "Sequencer.h"
+#include "SpscQueue.h"
+#include "TileLayout.h"
+
+struct NoteEvent
+{
+	int note;
+	int velocity; // 0 releases a held note
+	int gateMs;
+};
+
+// Everything one camera frame carries from stage to stage.
+struct FrameContext
+{
+	// As the camera delivered it, unmirrored: turned into BGR and mirrored
+	// only for display, see bgrImage()
+	cv::Mat image;
+	PixelFormat format = PixelFormat::Bgr;
+	cv::Mat labels; // Marker class per pixel, mirrored, see ColourClassifier
+	BitMask bits;   // Any marker colour, after noise suppression
+	uint64_t sequence = 0;
+	std::chrono::steady_clock::time_point timestamp;
+	// When the frame entered the pipeline, which latencies are measured
+	// from: its capture time when live, when it was read when replaying
+	std::chrono::steady_clock::time_point arrived;
+
+	// Filled in by the tracking stage
+	std::vector<Blob> blobs;      // Largest first
+	std::vector<Track> tracks;    // Markers seen in this frame
+	std::vector<NoteEvent> notes; // Hits of playable tiles, and releases of held ones
+	std::vector<ZoneState> zoneState; // One per layout zone
+	std::vector<MidiEvent> midi;      // Everything handed to the MIDI engine, when kept (see process())
+};
+
+struct QueueConfig
+{
+	size_t capacity;
+	OverflowPolicy policy;
+};
+
+// Depth and overflow behaviour of each link between stages, and of the
+// event queue into the MIDI engine. Frame links keep only the freshest
+// frames; the MIDI queue is deep enough never to fill in practice, and
+// should it fill, drops the oldest event rather than stall tracking.
+struct PipelineConfig
+{
+	QueueConfig segmentToTrack = { 2, OverflowPolicy::DropOldest };
+	QueueConfig trackToRender = { 2, OverflowPolicy::DropOldest };
+	QueueConfig midiEvents = { 1024, OverflowPolicy::DropOldest };
+	// Byte budget and controller coalescing of the MIDI output
+	ShaperConfig midiOutput;
+
+	// Noise suppression: the former erode, erode, dilate chain of 5x5
+	// rectangles is a 9x9 erosion followed by a 5x5 dilation
+	int erodeSize = 9;
+	int dilateSize = 5;
+	// Blobs smaller than this many pixels are ignored by tracking
+	int minBlobArea = 30;
+
+	// Marker tracking: how many markers at most, and how far (in pixels)
+	// a marker may move away from its predicted position between frames
+	int maxMarkers = 10;
+	float matchDistance = 80;
+	// Alpha-beta filter gains for marker position and velocity
+	float trackerAlpha = 0.75f;
+	float trackerBeta = 0.3f;
+
+	// Predictive triggering: delay the program cannot measure (camera,
+	// USB, MIDI output) and the approach speed that plays velocity 127
+	float latencyMs = 60;
+	float fullVelocitySpeed = 1500;
+
+	// MIDI clock input port to follow, or -1 for none, and the grid notes
+	// are moved onto while that clock runs: 16 for sixteenths, 32 for
+	// thirty-seconds, 0 to play them as they come
+	int clockInput = -1;
+	int quantise = 0;
+
+	// Tempo and MIDI clock output, and the pattern sequencer's bar and
+	// look-ahead
+	TempoConfig tempo;
+	SequencerConfig sequencer;
+
+	// Which camera and how, and a raw recording of its frames, for
+	// replaying them later
+	CameraConfig camera;
+	RecordConfig record;
+
+	// Reads the optional "pipeline" object from object.json, e.g.
+	// "pipeline": { "midiEvents": { "capacity": 4096, "policy": "block" },
+	//               "erodeSize": 9, "dilateSize": 5, "minBlobArea": 30,
+	//               "maxMarkers": 10, "matchDistance": 80,
+	//               "trackerAlpha": 0.75, "trackerBeta": 0.3,
+	//               "latencyMs": 60, "fullVelocitySpeed": 1500,
+	//               "midiOutput": { "bytesPerSecond": 3125, "coalesceMs": 10 },
+	//               "clockInput": 0, "quantise": 16,
+	//               "tempo": { "bpm": 120, "sendClock": true },
+	//               "sequencer": { "beatsPerBar": 4, "lookAheadMs": 40 },
+	//               "camera": { "backend": "v4l2", "width": 1280, "height": 720, "fps": 60 },
+	//               "record": { "path": "session", "segmentMB": 1024 } }
+	static PipelineConfig fromJson(const Json::Value& data);
+};
+
+// Staged frame engine: capture -> segment -> track -> render.
+// Capture, segmentation and tracking each run on their own thread; notes
+// go from tracking to the MIDI engine's thread, pattern tiles drive the
+// sequencer's thread, and rendering stays on the calling thread because
+// HighGUI has to.
+class FramePipeline
+{
+public:
+	FramePipeline(FrameCapture& capture, ColourClassifier& classifier, const TileLayout& layout, MidiEngine& midi,
+		ClockSync& clock, ClockGenerator& tempo, Sequencer& sequencer, LatencyReport& latency, const PipelineConfig& config);
+	~FramePipeline();
+
+	FramePipeline(const FramePipeline&) = delete;
+	FramePipeline& operator=(const FramePipeline&) = delete;
+
+	void start();
+	void stop();
+
+	// Render side: takes the newest finished frame, if any.
+	bool nextFrame(FrameContext& frame);
+
+	// Instead of start(): takes captured through segmentation, tracking and
+	// MIDI output on the calling thread, for replaying a clip frame by
+	// frame at full speed. Returns how many events went to the MIDI
+	// engine; with keepMidi, they are also copied into frame.midi.
+	size_t process(const CapturedFrame& captured, FrameContext& frame, bool keepMidi);
+
+	void printStats(std::ostream& out) const;
+
+private:
+	void segmentStage();
+	void trackStage();
+
+	void segmentFrame(const CapturedFrame& captured, FrameContext& frame);
+	void trackFrame(FrameContext& frame);
+	size_t sendFrame(FrameContext& frame, bool keepMidi);
+	void playZone(FrameContext& frame, const Track& marker, int index);
+	void releaseHeld(FrameContext& frame, const std::vector<Track>& tracks);
+
+	FrameCapture& capture_;
+	ColourClassifier& classifier_;
+	const TileLayout& layout_;
+	MidiEngine& midi_;
+	ClockSync& clock_;
+	ClockGenerator& tempo_;
+	Sequencer& sequencer_;
+	LatencyReport& latency_;
+	int quantiseTicks_; // MIDI clocks per grid step, 0 when off
+
+	BinaryMorphology morphology_;
+	cv::Mat labels_; // Segmentation stage: labels before mirroring
+
+	SpscQueue<FrameContext> segmentToTrack_;
+	SpscQueue<FrameContext> trackToRender_;
+
+	std::atomic<bool> running_;
+	std::thread segmentThread_;
+	std::thread trackThread_;
+
+	// Tracking stage state
+	BlobExtractor blobExtractor_;
+	MarkerTracker tracker_;
+	HitPredictor predictor_;
+	ControllerMap controllers_;
+	int track_; // Base note of the selected track
+	std::vector<ZoneState> zoneState_;
+
+	// A note played from a zone with no gate, sounding until the marker
+	// that played it leaves the zone or is lost
+	struct HeldNote
+	{
+		int trackId;
+		int zone;
+		int note;
+	};
+	std::vector<HeldNote> held_;
+};
@@ -0,0 +1,298 @@
+#include "Segmentation.h"
+
+#include <algorithm>
+
+#include "SimdSupport.h"
+
+// Fixed-point reciprocal tables, built the same way as OpenCV's RGB2HSV_b
+// so that the fused kernel reproduces cvtColor exactly.
+static const int hsvShift = 12;
+
+struct HsvTables
+{
+	int sdiv[256];
+	int hdiv[256];
+
+	HsvTables()
+	{
+		sdiv[0] = hdiv[0] = 0;
+		for (int i = 1; i < 256; i++)
+		{
+			sdiv[i] = cv::saturate_cast<int>((255 << hsvShift) / (1. * i));
+			hdiv[i] = cv::saturate_cast<int>((180 << hsvShift) / (6. * i));
+		}
+	}
+};
+
+static const HsvTables& hsvTables()
+{
+	static const HsvTables tables;
+	return tables;
+}
+
+void segmentHsvRowScalar(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds)
+{
+	const HsvTables& tables = hsvTables();
+	const int round = 1 << (hsvShift - 1);
+
+	for (int x = 0; x < width; x++, bgr += 3)
+	{
+		int b = bgr[0], g = bgr[1], r = bgr[2];
+		int v = std::max(b, std::max(g, r));
+		int vmin = std::min(b, std::min(g, r));
+		int diff = v - vmin;
+
+		int s = (diff * tables.sdiv[v] + round) >> hsvShift;
+		int h = v == r ? g - b : (v == g ? b - r + 2 * diff : r - g + 4 * diff);
+		h = (h * tables.hdiv[diff] + round) >> hsvShift;
+		h += h < 0 ? 180 : 0;
+
+		bool inside = bounds.lower[0] <= h && h <= bounds.upper[0]
+			&& bounds.lower[1] <= s && s <= bounds.upper[1]
+			&& bounds.lower[2] <= v && v <= bounds.upper[2];
+		mask[x] = inside ? 255 : 0;
+	}
+}
+
+#if defined(AURA_X86)
+
+AURA_TARGET_SSE41 void segmentHsvRowSse41(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds)
+{
+	const HsvTables& tables = hsvTables();
+	const __m128i round = _mm_set1_epi32(1 << (hsvShift - 1));
+	const __m128i hueRange = _mm_set1_epi32(180);
+	const __m128i hLow = _mm_set1_epi32(bounds.lower[0] - 1), hHigh = _mm_set1_epi32(bounds.upper[0] + 1);
+	const __m128i sLow = _mm_set1_epi32(bounds.lower[1] - 1), sHigh = _mm_set1_epi32(bounds.upper[1] + 1);
+	const __m128i vLow = _mm_set1_epi8(static_cast<char>(bounds.lower[2]));
+	const __m128i vHigh = _mm_set1_epi8(static_cast<char>(bounds.upper[2]));
+	alignas(16) uchar vBytes[16];
+	alignas(16) uchar diffBytes[16];
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i b, g, r;
+		deinterleaveBgr(bgr + 3 * x, b, g, r);
+
+		__m128i v = _mm_max_epu8(b, _mm_max_epu8(g, r));
+		__m128i diff = _mm_sub_epi8(v, _mm_min_epu8(b, _mm_min_epu8(g, r)));
+		__m128i isR = _mm_cmpeq_epi8(v, r);
+		__m128i isG = _mm_cmpeq_epi8(v, g);
+		__m128i inside = inRangeU8(v, vLow, vHigh);
+		_mm_store_si128(reinterpret_cast<__m128i*>(vBytes), v);
+		_mm_store_si128(reinterpret_cast<__m128i*>(diffBytes), diff);
+
+		__m128i outside16[2];
+		for (int half = 0; half < 2; half++)
+		{
+			// Hue numerator fits comfortably in 16 bits (|h| <= 5 * diff)
+			__m128i b16 = _mm_cvtepu8_epi16(b);
+			__m128i g16 = _mm_cvtepu8_epi16(g);
+			__m128i r16 = _mm_cvtepu8_epi16(r);
+			__m128i d16 = _mm_cvtepu8_epi16(diff);
+			__m128i fromR = _mm_sub_epi16(g16, b16);
+			__m128i fromG = _mm_add_epi16(_mm_sub_epi16(b16, r16), _mm_slli_epi16(d16, 1));
+			__m128i fromB = _mm_add_epi16(_mm_sub_epi16(r16, g16), _mm_slli_epi16(d16, 2));
+			__m128i h16 = _mm_blendv_epi8(_mm_blendv_epi8(fromB, fromG, _mm_cvtepi8_epi16(isG)), fromR, _mm_cvtepi8_epi16(isR));
+
+			__m128i outside32[2];
+			for (int quarter = 0; quarter < 2; quarter++)
+			{
+				const int k = half * 8 + quarter * 4;
+				__m128i hdiv = _mm_setr_epi32(tables.hdiv[diffBytes[k]], tables.hdiv[diffBytes[k + 1]],
+					tables.hdiv[diffBytes[k + 2]], tables.hdiv[diffBytes[k + 3]]);
+				__m128i sdiv = _mm_setr_epi32(tables.sdiv[vBytes[k]], tables.sdiv[vBytes[k + 1]],
+					tables.sdiv[vBytes[k + 2]], tables.sdiv[vBytes[k + 3]]);
+
+				__m128i h = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(_mm_cvtepi16_epi32(h16), hdiv), round), hsvShift);
+				h = _mm_add_epi32(h, _mm_and_si128(_mm_cmplt_epi32(h, _mm_setzero_si128()), hueRange));
+				__m128i s = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(d16), sdiv), round), hsvShift);
+
+				__m128i hOk = _mm_and_si128(_mm_cmpgt_epi32(h, hLow), _mm_cmplt_epi32(h, hHigh));
+				__m128i sOk = _mm_and_si128(_mm_cmpgt_epi32(s, sLow), _mm_cmplt_epi32(s, sHigh));
+				outside32[quarter] = _mm_andnot_si128(_mm_and_si128(hOk, sOk), _mm_set1_epi32(-1));
+
+				h16 = _mm_srli_si128(h16, 8);
+				d16 = _mm_srli_si128(d16, 8);
+			}
+			outside16[half] = _mm_packs_epi32(outside32[0], outside32[1]);
+
+			b = _mm_srli_si128(b, 8);
+			g = _mm_srli_si128(g, 8);
+			r = _mm_srli_si128(r, 8);
+			diff = _mm_srli_si128(diff, 8);
+			isR = _mm_srli_si128(isR, 8);
+			isG = _mm_srli_si128(isG, 8);
+		}
+
+		__m128i outside = _mm_packs_epi16(outside16[0], outside16[1]);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(mask + x), _mm_andnot_si128(outside, inside));
+	}
+
+	segmentHsvRowScalar(bgr + 3 * x, mask + x, width - x, bounds);
+}
+
+AURA_TARGET_AVX2 void segmentHsvRowAvx2(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds)
+{
+	const HsvTables& tables = hsvTables();
+	const __m256i round = _mm256_set1_epi32(1 << (hsvShift - 1));
+	const __m256i hueRange = _mm256_set1_epi32(180);
+	const __m256i hLow = _mm256_set1_epi32(bounds.lower[0] - 1), hHigh = _mm256_set1_epi32(bounds.upper[0] + 1);
+	const __m256i sLow = _mm256_set1_epi32(bounds.lower[1] - 1), sHigh = _mm256_set1_epi32(bounds.upper[1] + 1);
+	const __m128i vLow = _mm_set1_epi8(static_cast<char>(bounds.lower[2]));
+	const __m128i vHigh = _mm_set1_epi8(static_cast<char>(bounds.upper[2]));
+
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i b, g, r;
+		deinterleaveBgr(bgr + 3 * x, b, g, r);
+
+		__m128i v = _mm_max_epu8(b, _mm_max_epu8(g, r));
+		__m128i diff = _mm_sub_epi8(v, _mm_min_epu8(b, _mm_min_epu8(g, r)));
+		__m128i isR = _mm_cmpeq_epi8(v, r);
+		__m128i isG = _mm_cmpeq_epi8(v, g);
+		__m128i inside = inRangeU8(v, vLow, vHigh);
+
+		__m256i outside32[2];
+		for (int half = 0; half < 2; half++)
+		{
+			__m256i b32 = _mm256_cvtepu8_epi32(b);
+			__m256i g32 = _mm256_cvtepu8_epi32(g);
+			__m256i r32 = _mm256_cvtepu8_epi32(r);
+			__m256i v32 = _mm256_cvtepu8_epi32(v);
+			__m256i d32 = _mm256_cvtepu8_epi32(diff);
+
+			__m256i fromR = _mm256_sub_epi32(g32, b32);
+			__m256i fromG = _mm256_add_epi32(_mm256_sub_epi32(b32, r32), _mm256_slli_epi32(d32, 1));
+			__m256i fromB = _mm256_add_epi32(_mm256_sub_epi32(r32, g32), _mm256_slli_epi32(d32, 2));
+			__m256i h = _mm256_blendv_epi8(_mm256_blendv_epi8(fromB, fromG, _mm256_cvtepi8_epi32(isG)), fromR, _mm256_cvtepi8_epi32(isR));
+
+			__m256i hdiv = _mm256_i32gather_epi32(tables.hdiv, d32, 4);
+			__m256i sdiv = _mm256_i32gather_epi32(tables.sdiv, v32, 4);
+
+			h = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(h, hdiv), round), hsvShift);
+			h = _mm256_add_epi32(h, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), h), hueRange));
+			__m256i s = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(d32, sdiv), round), hsvShift);
+
+			__m256i hOk = _mm256_and_si256(_mm256_cmpgt_epi32(h, hLow), _mm256_cmpgt_epi32(hHigh, h));
+			__m256i sOk = _mm256_and_si256(_mm256_cmpgt_epi32(s, sLow), _mm256_cmpgt_epi32(sHigh, s));
+			outside32[half] = _mm256_andnot_si256(_mm256_and_si256(hOk, sOk), _mm256_set1_epi32(-1));
+
+			b = _mm_srli_si128(b, 8);
+			g = _mm_srli_si128(g, 8);
+			r = _mm_srli_si128(r, 8);
+			v = _mm_srli_si128(v, 8);
+			diff = _mm_srli_si128(diff, 8);
+			isR = _mm_srli_si128(isR, 8);
+			isG = _mm_srli_si128(isG, 8);
+		}
+
+		// packs works per 128-bit lane, so restore pixel order before narrowing
+		__m256i outside16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(outside32[0], outside32[1]), 0xD8);
+		__m128i outside = _mm_packs_epi16(_mm256_castsi256_si128(outside16), _mm256_extracti128_si256(outside16, 1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(mask + x), _mm_andnot_si128(outside, inside));
+	}
+
+	segmentHsvRowScalar(bgr + 3 * x, mask + x, width - x, bounds);
+}
+
+#else
+
+void segmentHsvRowSse41(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds)
+{
+	segmentHsvRowScalar(bgr, mask, width, bounds);
+}
+
+void segmentHsvRowAvx2(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds)
+{
+	segmentHsvRowScalar(bgr, mask, width, bounds);
+}
+
+#endif
+
+SimdLevel detectSimdLevel()
+{
+#if defined(AURA_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse41 = __builtin_cpu_supports("sse4.1");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2)
+	{
+		return SimdLevel::Avx2;
+	}
+	if (sse41)
+	{
+		return SimdLevel::Sse41;
+	}
+#endif
+	return SimdLevel::Scalar;
+}
+
+const char* simdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::Avx2:
+		return "AVX2";
+	case SimdLevel::Sse41:
+		return "SSE4.1";
+	default:
+		return "scalar";
+	}
+}
+
+typedef void (*SegmentRowKernel)(const uchar*, uchar*, int, const HsvBounds&);
+
+static SegmentRowKernel rowKernel(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::Avx2:
+		return segmentHsvRowAvx2;
+	case SimdLevel::Sse41:
+		return segmentHsvRowSse41;
+	default:
+		return segmentHsvRowScalar;
+	}
+}
+
+void segmentHsv(const cv::Mat& bgr, const HsvBounds& bounds, cv::Mat& mask, SimdLevel level)
+{
+	CV_Assert(bgr.type() == CV_8UC3);
+	mask.create(bgr.size(), CV_8UC1);
+
+	SegmentRowKernel kernel = rowKernel(level);
+	for (int y = 0; y < bgr.rows; y++)
+	{
+		kernel(bgr.ptr<uchar>(y), mask.ptr<uchar>(y), bgr.cols, bounds);
+	}
+}
+
+void segmentHsv(const cv::Mat& bgr, const HsvBounds& bounds, cv::Mat& mask)
+{
+	static const SimdLevel level = detectSimdLevel();
+	segmentHsv(bgr, bounds, mask, level);
+}
+
+void segmentHsvRow(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds)
+{
+	static const SegmentRowKernel kernel = rowKernel(detectSimdLevel());
+	kernel(bgr, mask, width, bounds);
+}
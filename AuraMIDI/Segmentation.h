@@ -0,0 +1,39 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+// Inclusive HSV bounds in OpenCV's 8-bit convention (H 0-180, S/V 0-255).
+struct HsvBounds
+{
+	uchar lower[3];
+	uchar upper[3];
+};
+
+// Instruction set used by the fused segmentation kernel.
+enum class SimdLevel
+{
+	Scalar,
+	Sse41,
+	Avx2
+};
+
+// Best level supported by this CPU (and this build).
+SimdLevel detectSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// Fused single-pass BGR -> HSV threshold: writes 255 for pixels inside the
+// bounds and 0 otherwise, without ever materialising an HSV image.
+// The result is bit-for-bit identical to
+//   cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+//   cv::inRange(hsv, lower, upper, mask);
+void segmentHsv(const cv::Mat& bgr, const HsvBounds& bounds, cv::Mat& mask);
+void segmentHsv(const cv::Mat& bgr, const HsvBounds& bounds, cv::Mat& mask, SimdLevel level);
+
+// One row of packed 8-bit BGR pixels, using the best kernel for this CPU.
+void segmentHsvRow(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds);
+
+// Row kernels, exposed for benchmarking.
+void segmentHsvRowScalar(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds);
+void segmentHsvRowSse41(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds);
+void segmentHsvRowAvx2(const uchar* bgr, uchar* mask, int width, const HsvBounds& bounds);
@@ -0,0 +1,198 @@
+#include "Sequencer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ThreadPriority.h"
+
+// Tile presses waiting for the sequencer thread at most
+static const size_t commandCapacity = 64;
+// Longest sleep, so stop() is not kept waiting at slow tempos
+static const std::chrono::milliseconds maxSleep(10);
+
+SequencerConfig SequencerConfig::fromJson(const Json::Value& value)
+{
+	SequencerConfig config;
+	if (!value.isObject())
+	{
+		return config;
+	}
+	config.beatsPerBar = std::max(1, value.get("beatsPerBar", config.beatsPerBar).asInt());
+	config.lookAheadMs = std::max(1, value.get("lookAheadMs", config.lookAheadMs).asInt());
+	config.channel = value.get("channel", config.channel).asInt() & 0x0F;
+	return config;
+}
+
+Sequencer::Sequencer(const TileLayout& layout, MidiEngine& midi, ClockGenerator& tempo, const SequencerConfig& config)
+	: layout_(layout), midi_(midi), tempo_(tempo), config_(config),
+	clocksPerTick_(24.0 * config.beatsPerBar / ticksPerBar), commands_(commandCapacity, OverflowPolicy::DropOldest),
+	running_(false), realtime_(false), nextTick_(0), steps_(0), notes_(0), late_(0)
+{
+}
+
+Sequencer::~Sequencer()
+{
+	stop();
+}
+
+void Sequencer::start()
+{
+	if (running_)
+	{
+		return;
+	}
+	nextTick_ = 0;
+	running_ = true;
+	thread_ = std::thread(&Sequencer::run, this);
+	realtime_ = raiseThreadPriority(thread_);
+}
+
+void Sequencer::stop()
+{
+	running_ = false;
+	if (thread_.joinable())
+	{
+		thread_.join();
+	}
+}
+
+void Sequencer::launch(int track, int zone)
+{
+	Command command;
+	command.track = track & 0x7F;
+	command.zone = zone;
+	commands_.push(std::move(command), running_);
+}
+
+void Sequencer::toggleMute(int track)
+{
+	Command command;
+	command.track = track & 0x7F;
+	commands_.push(std::move(command), running_);
+}
+
+void Sequencer::printStats(std::ostream& out) const
+{
+	uint64_t steps = steps_.load(std::memory_order_relaxed);
+	if (steps == 0)
+	{
+		return;
+	}
+	out << "Sequencer: " << steps << " steps, " << notes_.load(std::memory_order_relaxed) << " notes, "
+		<< late_.load(std::memory_order_relaxed) << " handed over late, tile presses dropped: " << commands_.dropped()
+		<< (realtime_ ? "" : " (no real-time priority)") << std::endl;
+}
+
+Sequencer::TimePoint Sequencer::timeOf(int64_t tick, const ClockState& timeline) const
+{
+	// From the newest clock at the current tempo; a ramp moves on too
+	// little within the look-ahead to matter
+	const double clocks = tick * clocksPerTick_ - timeline.tick;
+	return timeline.tickTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(clocks * timeline.tickSeconds));
+}
+
+void Sequencer::run()
+{
+	const std::chrono::milliseconds lookAhead(config_.lookAheadMs);
+	while (running_)
+	{
+		Command command;
+		while (commands_.tryPop(command))
+		{
+			apply(command);
+		}
+
+		const TimePoint now = std::chrono::steady_clock::now();
+		const ClockState& timeline = tempo_.timeline();
+		if (!timeline.running)
+		{
+			std::this_thread::sleep_until(now + maxSleep);
+			continue;
+		}
+
+		// Everything due within the look-ahead goes to the engine now
+		while (timeOf(nextTick_, timeline) < now + lookAhead)
+		{
+			tick(nextTick_, timeline, now);
+			nextTick_++;
+		}
+
+		// Until the next tick comes within reach
+		std::this_thread::sleep_until(std::min(timeOf(nextTick_, timeline) - lookAhead, now + maxSleep));
+	}
+}
+
+void Sequencer::apply(const Command& command)
+{
+	Lane& lane = lanes_[command.track];
+	if (command.zone < 0)
+	{
+		// Pressing twice before the bar line changes nothing
+		lane.toggleMute = !lane.toggleMute;
+		return;
+	}
+	const Pattern* pattern = &layout_.zone(command.zone).pattern;
+	// The pattern already playing carries on; a different one waits
+	lane.queued = pattern == lane.playing ? nullptr : pattern;
+}
+
+void Sequencer::tick(int64_t tick, const ClockState& timeline, TimePoint now)
+{
+	const TimePoint at = timeOf(tick, timeline);
+	const bool barLine = tick % ticksPerBar == 0;
+
+	for (int track = 0; track < 128; track++)
+	{
+		Lane& lane = lanes_[track];
+		if (barLine)
+		{
+			if (lane.toggleMute)
+			{
+				lane.muted = !lane.muted;
+				lane.toggleMute = false;
+			}
+			if (lane.queued)
+			{
+				lane.playing = lane.queued;
+				lane.queued = nullptr;
+				lane.originTick = tick;
+			}
+		}
+
+		const Pattern* pattern = lane.playing;
+		if (!pattern)
+		{
+			continue;
+		}
+		const int stepTicks = ticksPerBar / pattern->division;
+		const int64_t position = tick - lane.originTick;
+		if (position % stepTicks != 0)
+		{
+			continue;
+		}
+		steps_.fetch_add(1, std::memory_order_relaxed);
+		const std::vector<int>& notes = pattern->steps[(position / stepTicks) % pattern->steps.size()];
+		if (lane.muted || notes.empty())
+		{
+			continue;
+		}
+
+		if (at < now)
+		{
+			late_.fetch_add(notes.size(), std::memory_order_relaxed);
+		}
+		// Never 0, which would hold the note
+		const uint32_t gateMs = static_cast<uint32_t>(std::max(1.0, std::round(pattern->gate * stepTicks * clocksPerTick_ * timeline.tickSeconds * 1000)));
+		for (int offset : notes)
+		{
+			const int note = track + offset;
+			if (note < 0 || note > 127)
+			{
+				continue;
+			}
+			midi_.sendAt(TimedSource::Sequencer, MidiEvent::noteOn(config_.channel, note, pattern->velocity, gateMs), at);
+			notes_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+
+#include "ClockGenerator.h"
+#include "MidiEngine.h"
+#include "SpscQueue.h"
+#include "TileLayout.h"
+
+struct SequencerConfig
+{
+	int beatsPerBar = 4;
+	int lookAheadMs = 40; // How far ahead of time notes go to the MIDI engine
+	int channel = 0;
+
+	// Reads the optional "sequencer" object of the "pipeline" settings, e.g.
+	// "sequencer": { "beatsPerBar": 4, "lookAheadMs": 40, "channel": 0 }
+	static SequencerConfig fromJson(const Json::Value& value);
+};
+
+// Step sequencer behind the pattern tiles. Every track (told apart by its
+// base note) plays at most one pattern; launching another one, or muting
+// or unmuting the track, takes effect at the next bar line.
+//
+// The sequencer has its own thread, raised to real-time priority where
+// the system allows. It walks a grid of 96 ticks to the bar, laid over
+// the clock generator's timeline so patterns keep time with the MIDI
+// clock and follow its tempo, and hands every note to the MIDI engine
+// lookAheadMs before it is due, stamped with the time it is due, so
+// pattern timing depends neither on the camera frame rate nor on when the
+// tracking stage gets to run. Tiles reach it through a lock-free queue.
+class Sequencer
+{
+public:
+	Sequencer(const TileLayout& layout, MidiEngine& midi, ClockGenerator& tempo, const SequencerConfig& config);
+	~Sequencer();
+
+	Sequencer(const Sequencer&) = delete;
+	Sequencer& operator=(const Sequencer&) = delete;
+
+	// Start after the MIDI engine and stop before it. Notes begin with the
+	// clock generator.
+	void start();
+	void stop();
+
+	// Producer side, for a single thread. track is the track's base note,
+	// zone a pattern tile with steps.
+	void launch(int track, int zone);
+	void toggleMute(int track);
+
+	void printStats(std::ostream& out) const;
+
+private:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	static const int ticksPerBar = 96;
+
+	struct Command
+	{
+		int track = 0;
+		int zone = -1; // -1 toggles mute
+	};
+
+	struct Lane
+	{
+		const Pattern* playing = nullptr;
+		const Pattern* queued = nullptr; // Starts at the next bar
+		bool muted = false;
+		bool toggleMute = false;         // At the next bar
+		int64_t originTick = 0;          // Where playing started
+	};
+
+	void run();
+	void apply(const Command& command);
+	void tick(int64_t tick, const ClockState& timeline, TimePoint now);
+	TimePoint timeOf(int64_t tick, const ClockState& timeline) const;
+
+	const TileLayout& layout_;
+	MidiEngine& midi_;
+	ClockGenerator& tempo_;
+	SequencerConfig config_;
+	double clocksPerTick_;
+	SpscQueue<Command> commands_;
+
+	std::atomic<bool> running_;
+	std::thread thread_;
+	bool realtime_; // Got real-time priority
+
+	// Sequencer thread only
+	int64_t nextTick_;    // First tick not yet handed over
+	Lane lanes_[128];     // By base note
+
+	std::atomic<uint64_t> steps_;
+	std::atomic<uint64_t> notes_;
+	std::atomic<uint64_t> late_; // Handed over after they were due
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AURA_X86 1
+#include <immintrin.h>
+#endif
+
+// SSE2 is part of the baseline on x64 and on MSVC's default x86 target.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AURA_SSE2 1
+#endif
+
+// MSVC accepts any intrinsic without extra flags; GCC and Clang need the
+// target enabled per function so the rest of a file stays baseline x86.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define AURA_TARGET_SSE41
+#define AURA_TARGET_AVX2
+#else
+#define AURA_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define AURA_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Index of the lowest set bit; the word must not be zero.
+static inline int countTrailingZeros(uint64_t word)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+	_BitScanForward64(&index, word);
+#else
+	if (_BitScanForward(&index, static_cast<unsigned long>(word)))
+	{
+		return static_cast<int>(index);
+	}
+	_BitScanForward(&index, static_cast<unsigned long>(word >> 32));
+	index += 32;
+#endif
+	return static_cast<int>(index);
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+#if defined(AURA_X86)
+
+// Splits 16 packed BGR pixels (48 bytes) into one vector per channel.
+AURA_TARGET_SSE41 static inline void deinterleaveBgr(const uchar* p, __m128i& b, __m128i& g, __m128i& r)
+{
+	const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+	const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+	const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+	const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+	const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+	const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+	__m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	__m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+	__m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32));
+
+	b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x0, b0), _mm_shuffle_epi8(x1, b1)), _mm_shuffle_epi8(x2, b2));
+	g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x0, g0), _mm_shuffle_epi8(x1, g1)), _mm_shuffle_epi8(x2, g2));
+	r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x0, r0), _mm_shuffle_epi8(x1, r1)), _mm_shuffle_epi8(x2, r2));
+}
+
+// All-ones where lower <= value <= upper, for unsigned bytes.
+AURA_TARGET_SSE41 static inline __m128i inRangeU8(__m128i value, __m128i lower, __m128i upper)
+{
+	return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(value, lower), value),
+		_mm_cmpeq_epi8(_mm_min_epu8(value, upper), value));
+}
+
+#endif
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// What a full queue does with a new item.
+enum class OverflowPolicy
+{
+	DropOldest, // Discard the oldest queued item to make room
+	Block       // Wait until the consumer has made room
+};
+
+// Spin briefly, then yield, then sleep. Used by the queues and stage threads
+// to wait for work without holding any locks.
+inline void backoff(unsigned& spins)
+{
+	if (spins < 64)
+	{
+		std::this_thread::yield();
+	}
+	else
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+	spins++;
+}
+
+// Bounded single-producer/single-consumer ring queue.
+// Every cell carries a sequence number (Vyukov style) so that the producer
+// can also take items off the tail when it drops the oldest entry, without
+// ever racing the consumer on the contents of a cell.
+template <typename T>
+class SpscQueue
+{
+public:
+	SpscQueue(size_t capacity, OverflowPolicy policy)
+		: policy_(policy), head_(0), tail_(0), dropped_(0)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		mask_ = size - 1;
+		cells_.reset(new Cell[size]);
+		for (size_t i = 0; i < size; i++)
+		{
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// Producer side. Returns false only if the queue blocked and the running
+	// flag was cleared before room became available.
+	bool push(T&& item, const std::atomic<bool>& running)
+	{
+		unsigned spins = 0;
+		while (!tryPush(item))
+		{
+			if (policy_ == OverflowPolicy::DropOldest)
+			{
+				T oldest;
+				if (tryPop(oldest))
+				{
+					dropped_.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+			}
+			if (!running.load(std::memory_order_relaxed))
+			{
+				return false;
+			}
+			backoff(spins);
+		}
+		return true;
+	}
+
+	bool tryPop(T& item)
+	{
+		size_t pos = tail_.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true)
+		{
+			cell = &cells_[pos & mask_];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t dif = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+			if (dif == 0)
+			{
+				if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (dif < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = tail_.load(std::memory_order_relaxed);
+			}
+		}
+		item = std::move(cell->data);
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side. Waits for an item until the running flag is cleared.
+	bool pop(T& item, const std::atomic<bool>& running)
+	{
+		unsigned spins = 0;
+		while (!tryPop(item))
+		{
+			if (!running.load(std::memory_order_relaxed))
+			{
+				return false;
+			}
+			backoff(spins);
+		}
+		return true;
+	}
+
+	uint64_t dropped() const
+	{
+		return dropped_.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	bool tryPush(T& item)
+	{
+		Cell* cell = &cells_[head_ & mask_];
+		if (cell->sequence.load(std::memory_order_acquire) != head_)
+		{
+			return false;
+		}
+		cell->data = std::move(item);
+		cell->sequence.store(head_ + 1, std::memory_order_release);
+		head_++;
+		return true;
+	}
+
+	OverflowPolicy policy_;
+	std::unique_ptr<Cell[]> cells_;
+	size_t mask_;
+	alignas(64) size_t head_;             // Written by the producer only
+	alignas(64) std::atomic<size_t> tail_; // Advanced by the consumer, or the producer when dropping
+	std::atomic<uint64_t> dropped_;
+};
@@ -0,0 +1,22 @@
+#include "ThreadPriority.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool raiseThreadPriority(std::thread& thread)
+{
+#ifdef _WIN32
+	return SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+	// Below the kernel's interrupt threads (50), so device I/O, the MIDI
+	// port's included, never waits for it
+	sched_param param = {};
+	param.sched_priority = 40;
+	return pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) == 0;
+#endif
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <thread>
+
+// Asks the scheduler to run thread ahead of ordinary threads: real-time
+// FIFO scheduling where there is one (Linux needs CAP_SYS_NICE or an
+// rtprio limit for it), time-critical priority on Windows. Returns false,
+// leaving the thread as it was, if that is not allowed.
+bool raiseThreadPriority(std::thread& thread);
@@ -0,0 +1,346 @@
+#include "TileLayout.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Fractional bits used when scaling outlines down to the label grid
+static const int labelShift = 4;
+
+// Makes zone the rectangle rect.
+static void setRect(Zone& zone, cv::Rect rect)
+{
+	zone.bounds = rect;
+	zone.polygon = {
+		rect.tl(),
+		cv::Point(rect.x + rect.width - 1, rect.y),
+		cv::Point(rect.x + rect.width - 1, rect.y + rect.height - 1),
+		cv::Point(rect.x, rect.y + rect.height - 1)
+	};
+}
+
+static Zone rectZone(const std::string& label, ZoneType type, cv::Rect rect, int note)
+{
+	Zone zone;
+	zone.label = label;
+	zone.type = type;
+	zone.note = note;
+	setRect(zone, rect);
+	return zone;
+}
+
+static bool readRect(const Json::Value& value, cv::Rect& rect)
+{
+	if (!value.isArray() || value.size() != 4)
+	{
+		return false;
+	}
+	rect = cv::Rect(value[0].asInt(), value[1].asInt(), value[2].asInt(), value[3].asInt());
+	return rect.width > 0 && rect.height > 0;
+}
+
+// Reads one axis of an xy zone, e.g. { "cc": 74, "fine": true }.
+static ControllerAxis readAxis(const Json::Value& value)
+{
+	ControllerAxis axis;
+	if (!value.isObject())
+	{
+		return axis;
+	}
+	if (value.get("pitchBend", false).asBool())
+	{
+		axis.kind = ControllerKind::PitchBend;
+	}
+	else if (value.isMember("cc"))
+	{
+		axis.controller = value["cc"].asInt() & 0x7F;
+		// The LSB goes to controller + 32, so only 0..31 have one
+		bool fine = value.get("fine", false).asBool() && axis.controller < 32;
+		axis.kind = fine ? ControllerKind::Cc14 : ControllerKind::Cc7;
+	}
+	return axis;
+}
+
+// Reads the "pattern" of a pattern zone. Leaves the steps empty if there
+// is nothing to play.
+static Pattern readPattern(const Json::Value& value)
+{
+	Pattern pattern;
+	if (!value.isObject() || !value["steps"].isArray())
+	{
+		return pattern;
+	}
+	pattern.division = value.get("division", pattern.division).asInt();
+	if (pattern.division <= 0 || 96 % pattern.division != 0)
+	{
+		std::cout << "Pattern steps cannot be 1/" << pattern.division << " bar, using 1/16" << std::endl;
+		pattern.division = 16;
+	}
+	pattern.velocity = std::min(127, std::max(1, value.get("velocity", pattern.velocity).asInt()));
+	pattern.gate = std::min(1.0f, std::max(0.0f, value.get("gate", pattern.gate).asFloat()));
+
+	const Json::Value& steps = value["steps"];
+	bool any = false;
+	for (Json::Value::ArrayIndex i = 0; i < steps.size(); i++)
+	{
+		std::vector<int> notes;
+		if (steps[i].isArray())
+		{
+			for (Json::Value::ArrayIndex k = 0; k < steps[i].size(); k++)
+			{
+				notes.push_back(steps[i][k].asInt());
+			}
+		}
+		else if (steps[i].isNumeric())
+		{
+			notes.push_back(steps[i].asInt());
+		}
+		any = any || !notes.empty();
+		pattern.steps.push_back(notes);
+	}
+	if (!any)
+	{
+		pattern.steps.clear();
+	}
+	return pattern;
+}
+
+TileLayout::TileLayout()
+	: width_(640), height_(480), cellSize_(1), opacity_(1.0f)
+{
+}
+
+TileLayout TileLayout::defaultLayout()
+{
+	TileLayout layout;
+	layout.cellSize_ = 2;
+	const char* patterns[] = { "PAT 1", "PAT 2", "PAT 3", "PAT 4", "MUTE" };
+	const int patternNotes[] = { 1, 2, 3, 4, 9 };
+	for (int i = 0; i < 5; i++)
+	{
+		Zone zone = rectZone(patterns[i], ZoneType::Pattern, cv::Rect(80 + 95 * i, 0, 81, 81), patternNotes[i]);
+		zone.mute = i == 4;
+		layout.addZone(zone);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		std::string label = "TRACK " + std::to_string(i + 1);
+		layout.addZone(rectZone(label, ZoneType::Track, cv::Rect(0, 80 + 95 * i, 81, 81), 80 - 10 * i));
+	}
+	layout.compile();
+	return layout;
+}
+
+TileLayout TileLayout::fromJson(const Json::Value& data)
+{
+	const Json::Value& zones = data["zones"];
+	if (!zones.isArray() || zones.size() == 0)
+	{
+		return defaultLayout();
+	}
+
+	TileLayout layout;
+	layout.width_ = data.get("width", layout.width_).asInt();
+	layout.height_ = data.get("height", layout.height_).asInt();
+	layout.cellSize_ = std::max(1, data.get("cellSize", 2).asInt());
+	layout.opacity_ = std::min(1.0f, std::max(0.0f, data.get("opacity", 1.0f).asFloat()));
+	const int defaultGate = data.get("gate", Zone().gateMs).asInt();
+
+	for (Json::Value::ArrayIndex i = 0; i < zones.size(); i++)
+	{
+		const Json::Value& entry = zones[i];
+		std::string type = entry.get("type", "pad").asString();
+		std::string label = entry.get("label", "").asString();
+		int note = entry.get("note", 0).asInt();
+		int gateMs = std::max(0, entry.get("gate", defaultGate).asInt());
+
+		Zone zone;
+		if (type == "track")
+		{
+			zone.type = ZoneType::Track;
+		}
+		else if (type == "pattern")
+		{
+			zone.type = ZoneType::Pattern;
+		}
+		else if (type == "pad")
+		{
+			zone.type = ZoneType::Pad;
+		}
+		else if (type == "xy")
+		{
+			zone.type = ZoneType::XYPad;
+		}
+		else if (type == "tempo")
+		{
+			zone.type = ZoneType::Tempo;
+		}
+		else
+		{
+			std::cout << "Skipping zone " << i << " of unknown type \"" << type << "\"" << std::endl;
+			continue;
+		}
+
+		// Everything but the shape first, so every pad of a grid gets it
+		zone.label = label;
+		zone.note = note;
+		zone.gateMs = gateMs;
+		zone.mute = entry.get("mute", false).asBool();
+		if (zone.type == ZoneType::XYPad)
+		{
+			zone.axes[0] = readAxis(entry["x"]);
+			zone.axes[1] = readAxis(entry["y"]);
+			zone.axes[2] = readAxis(entry["size"]);
+			zone.channel = entry.get("channel", 0).asInt() & 0x0F;
+			const Json::Value& radius = entry["radius"];
+			if (radius.isArray() && radius.size() == 2 && radius[1].asFloat() > radius[0].asFloat())
+			{
+				zone.minRadius = radius[0].asFloat();
+				zone.maxRadius = radius[1].asFloat();
+			}
+			zone.smoothing = std::min(0.99f, std::max(0.0f, entry.get("smoothing", zone.smoothing).asFloat()));
+			if (zone.axes[0].kind == ControllerKind::None && zone.axes[1].kind == ControllerKind::None
+				&& zone.axes[2].kind == ControllerKind::None)
+			{
+				std::cout << "xy zone " << i << " has no x, y or size controller and sends nothing" << std::endl;
+			}
+		}
+		if (zone.type == ZoneType::Pattern)
+		{
+			zone.pattern = readPattern(entry["pattern"]);
+		}
+
+		cv::Rect rect;
+		if (readRect(entry["rect"], rect))
+		{
+			setRect(zone, rect);
+		}
+		else if (entry["circle"].isArray() && entry["circle"].size() == 3)
+		{
+			const Json::Value& circle = entry["circle"];
+			zone.center = cv::Point(circle[0].asInt(), circle[1].asInt());
+			zone.radius = circle[2].asInt();
+			zone.bounds = cv::Rect(zone.center.x - zone.radius, zone.center.y - zone.radius,
+				2 * zone.radius + 1, 2 * zone.radius + 1);
+		}
+		else if (entry["polygon"].isArray() && entry["polygon"].size() >= 3)
+		{
+			const Json::Value& polygon = entry["polygon"];
+			for (Json::Value::ArrayIndex k = 0; k < polygon.size(); k++)
+			{
+				zone.polygon.push_back(cv::Point(polygon[k][0].asInt(), polygon[k][1].asInt()));
+			}
+			zone.bounds = cv::boundingRect(zone.polygon);
+		}
+		else if (entry["grid"].isObject() && readRect(entry["grid"]["rect"], rect))
+		{
+			const Json::Value& grid = entry["grid"];
+			int cols = std::max(1, grid.get("cols", 1).asInt());
+			int rows = std::max(1, grid.get("rows", 1).asInt());
+			int gap = grid.get("gap", 0).asInt();
+			int cellWidth = (rect.width - (cols - 1) * gap) / cols;
+			int cellHeight = (rect.height - (rows - 1) * gap) / rows;
+			for (int r = 0; r < rows; r++)
+			{
+				for (int c = 0; c < cols; c++)
+				{
+					cv::Rect cell(rect.x + c * (cellWidth + gap), rect.y + r * (cellHeight + gap), cellWidth, cellHeight);
+					Zone pad = zone;
+					setRect(pad, cell);
+					pad.note = note + r * cols + c;
+					pad.label = label.empty() ? std::to_string(pad.note) : label;
+					layout.addZone(pad);
+				}
+			}
+			continue;
+		}
+		else
+		{
+			std::cout << "Skipping zone " << i << " without a rect, circle, polygon or grid" << std::endl;
+			continue;
+		}
+
+		layout.addZone(zone);
+	}
+
+	layout.compile();
+	return layout;
+}
+
+void TileLayout::addZone(const Zone& zone)
+{
+	zones_.push_back(zone);
+}
+
+void TileLayout::compile()
+{
+	if (zones_.size() > 65535)
+	{
+		std::cout << "Only the first 65535 zones are used" << std::endl;
+		zones_.resize(65535);
+	}
+	rasterize(labels_, cellSize_);
+
+	// A layout without patterns keeps pattern and mute tiles playing notes
+	bool sequencer = std::any_of(zones_.begin(), zones_.end(),
+		[](const Zone& zone) { return !zone.pattern.steps.empty(); });
+	for (Zone& zone : zones_)
+	{
+		zone.sequenced = sequencer && zone.type == ZoneType::Pattern && (zone.mute || !zone.pattern.steps.empty());
+	}
+}
+
+void TileLayout::rasterize(cv::Mat& labels, int cellSize) const
+{
+	labels = cv::Mat::zeros((height_ + cellSize - 1) / cellSize, (width_ + cellSize - 1) / cellSize, CV_16UC1);
+	const double scale = static_cast<double>(1 << labelShift) / cellSize;
+
+	for (int i = 0; i < static_cast<int>(zones_.size()); i++)
+	{
+		const Zone& zone = zones_[i];
+		cv::Scalar label(i + 1);
+		if (zone.radius > 0)
+		{
+			cv::Point center(cvRound(zone.center.x * scale), cvRound(zone.center.y * scale));
+			cv::circle(labels, center, cvRound(zone.radius * scale), label, cv::FILLED, cv::LINE_8, labelShift);
+			continue;
+		}
+
+		std::vector<std::vector<cv::Point>> outline(1);
+		for (const cv::Point& p : zone.polygon)
+		{
+			outline[0].push_back(cv::Point(cvRound(p.x * scale), cvRound(p.y * scale)));
+		}
+		cv::fillPoly(labels, outline, label, cv::LINE_8, labelShift);
+	}
+}
+
+void TileLayout::draw(cv::Mat& image, ZoneState state) const
+{
+	cv::Scalar white(256, 256, 256);
+	cv::Scalar grey(122, 122, 122);
+	cv::Scalar green(0, 256, 0);
+	cv::Scalar red(0, 0, 256);
+	const cv::Scalar& colour = state == ZoneState::Active ? green : (state == ZoneState::Muted ? red : grey);
+
+	for (const Zone& zone : zones_)
+	{
+		if (zone.radius > 0)
+		{
+			cv::circle(image, zone.center, zone.radius, colour, -1);
+		}
+		else
+		{
+			std::vector<std::vector<cv::Point>> outline(1, zone.polygon);
+			cv::fillPoly(image, outline, colour);
+		}
+
+		if (!zone.label.empty())
+		{
+			int baseline = 0;
+			cv::Size size = cv::getTextSize(zone.label, cv::FONT_HERSHEY_SIMPLEX, 0.5, 1, &baseline);
+			cv::Point origin(zone.bounds.x + (zone.bounds.width - size.width) / 2,
+				zone.bounds.y + (zone.bounds.height + size.height) / 2);
+			cv::putText(image, zone.label, origin, cv::FONT_HERSHEY_SIMPLEX, 0.5, white, 1, cv::LINE_AA);
+		}
+	}
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <json/json.h>
+#include <string>
+#include <vector>
+
+enum class ZoneType
+{
+	Track,   // Selects the track; note is the track's base note
+	Pattern, // Plays the selected track's base note + note
+	Pad,     // Plays note as it is
+	XYPad,   // Turns marker position and size into controllers
+	Tempo,   // Sets the tempo from the time between taps
+	Count    // How many types there are; new ones go above
+};
+
+// What one axis of an XY pad drives.
+enum class ControllerKind : unsigned char
+{
+	None,
+	Cc7,      // controller
+	Cc14,     // controller (MSB) and controller + 32 (LSB)
+	PitchBend
+};
+
+struct ControllerAxis
+{
+	ControllerKind kind = ControllerKind::None;
+	int controller = 0;
+};
+
+// How a zone is shown.
+enum class ZoneState : unsigned char
+{
+	Idle,
+	Active,
+	Muted // Active mute zone
+};
+
+// Steps a pattern tile launches on the selected track.
+struct Pattern
+{
+	int division = 16;   // Steps per bar
+	int velocity = 100;
+	float gate = 0.5f;   // How much of a step each note sounds for
+	// Per step, the notes to play relative to the track's base note; an
+	// empty step rests
+	std::vector<std::vector<int>> steps;
+};
+
+struct Zone
+{
+	std::string label;
+	ZoneType type = ZoneType::Pad;
+	int note = 0;
+	int gateMs = 100;  // How long a played note sounds; 0 holds it until the marker leaves
+	bool mute = false; // Lights red instead of green
+	cv::Rect bounds;
+
+	// Pattern zones only: what the sequencer plays. Once any tile in the
+	// layout has steps, tiles with steps launch their pattern and mute
+	// tiles mute the selected track instead of playing a note.
+	Pattern pattern;
+	bool sequenced = false; // Set at load time
+
+	// Outline in frame coordinates; a circle is kept as its centre plus
+	// radius so it can be drawn exactly
+	std::vector<cv::Point> polygon;
+	cv::Point center;
+	int radius = 0;
+
+	// XY pads only: controllers for x (left to right), y (bottom to top)
+	// and marker radius, the channel they are sent on, the radius range
+	// mapped onto the full controller range, and how much each frame's
+	// value is smoothed (0 none, towards 1 more)
+	ControllerAxis axes[3];
+	int channel = 0;
+	float minRadius = 5;
+	float maxRadius = 60;
+	float smoothing = 0.5f;
+};
+
+// Playing surface loaded from layout.json:
+//
+// { "width": 640, "height": 480, "cellSize": 2, "opacity": 1.0, "gate": 100,
+//   "zones": [
+//     { "type": "track", "label": "TRACK 1", "rect": [0, 80, 81, 81], "note": 80 },
+//     { "type": "pattern", "label": "PAT 1", "rect": [80, 0, 81, 81], "note": 1,
+//       "pattern": { "steps": [0, null, 7, [0, 12]], "division": 16, "velocity": 100, "gate": 0.5 } },
+//     { "type": "pad", "label": "KICK", "circle": [320, 400, 40], "note": 36, "gate": 250 },
+//     { "type": "pad", "polygon": [[500, 300], [600, 300], [550, 380]], "note": 38 },
+//     { "type": "pad", "grid": { "rect": [100, 100, 400, 400], "cols": 8, "rows": 8, "gap": 4 }, "note": 36 },
+//     { "type": "xy", "label": "FILTER", "rect": [440, 280, 200, 200], "channel": 0,
+//       "x": { "cc": 74 }, "y": { "cc": 1, "fine": true }, "size": { "pitchBend": true },
+//       "radius": [5, 60], "smoothing": 0.5 },
+//     { "type": "tempo", "label": "TAP", "rect": [555, 0, 81, 81] } ] }
+//
+// A grid expands into cols x rows rectangular pads numbered upwards from
+// note, row by row, each with the rest of the zone's settings. Zones listed later sit on top of earlier ones.
+// opacity below 1 lets the camera image show through the tiles. gate is
+// how many milliseconds a note plays for, per zone or as the default.
+// An xy zone plays no notes; each of x, y and size sends a 7-bit
+// controller, a 14-bit controller pair ("fine") or pitch bend. The
+// layout.json that ships has none, so out of the box no controllers are
+// sent; add one like FILTER above to get them.
+// A pattern's steps are note offsets from the track's base note: a
+// number, a list of them for a chord, or null for a rest. division (which
+// has to divide 96) says how many steps make a bar. Tapping a tempo zone
+// two or more times in a row sets the tempo.
+//
+// At load time every zone is painted into a label image with one 16-bit
+// entry per cellSize x cellSize block of the frame, so finding the zone
+// under a point is one memory read however many zones there are.
+class TileLayout
+{
+public:
+	TileLayout();
+
+	// The original four tracks, four patterns and mute.
+	static TileLayout defaultLayout();
+	static TileLayout fromJson(const Json::Value& data);
+
+	int zoneCount() const { return static_cast<int>(zones_.size()); }
+	const Zone& zone(int index) const { return zones_[index]; }
+	int cellSize() const { return cellSize_; }
+	int width() const { return width_; }
+	int height() const { return height_; }
+	float opacity() const { return opacity_; }
+
+	// Index of the topmost zone containing point, or -1.
+	int zoneAt(cv::Point2f point) const
+	{
+		int x = static_cast<int>(point.x) / cellSize_;
+		int y = static_cast<int>(point.y) / cellSize_;
+		if (point.x < 0 || point.y < 0 || x >= labels_.cols || y >= labels_.rows)
+		{
+			return -1;
+		}
+		return labels_.at<ushort>(y, x) - 1;
+	}
+
+	// Fills every zone with the colour of state and writes its label on top.
+	void draw(cv::Mat& image, ZoneState state) const;
+
+	// Paints zone index + 1 into a CV_16U image with one entry per
+	// cellSize x cellSize block.
+	void rasterize(cv::Mat& labels, int cellSize) const;
+
+private:
+	void addZone(const Zone& zone);
+	void compile();
+
+	int width_;
+	int height_;
+	int cellSize_;
+	float opacity_;
+	std::vector<Zone> zones_;
+	cv::Mat labels_; // CV_16U, zone index + 1, 0 where there is none
+};
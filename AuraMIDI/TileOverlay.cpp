@@ -0,0 +1,130 @@
+#include "TileOverlay.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "SimdSupport.h"
+
+// dst = (src * alpha + dst * (255 - alpha)) / 255, rounded, over count bytes.
+static void blendRow(uchar* dst, const uchar* src, int count, int alpha)
+{
+	int i = 0;
+#if defined(AURA_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i a = _mm_set1_epi16(static_cast<short>(alpha));
+	const __m128i b = _mm_set1_epi16(static_cast<short>(255 - alpha));
+	const __m128i half = _mm_set1_epi16(128);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+		// At most 255 * 255 + 128, so everything stays in unsigned 16 bits
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), a),
+			_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), b)), half);
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), a),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), b)), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		int x = src[i] * alpha + dst[i] * (255 - alpha) + 128;
+		dst[i] = static_cast<uchar>((x + (x >> 8)) >> 8);
+	}
+}
+
+TileOverlay::TileOverlay(const TileLayout& layout)
+	: layout_(layout), alpha_(cvRound(layout.opacity() * 255))
+{
+	const cv::Rect frame(0, 0, layout.width(), layout.height());
+	for (int s = 0; s < 3; s++)
+	{
+		layers_[s] = cv::Mat::zeros(frame.size(), CV_8UC3);
+		layout.draw(layers_[s], static_cast<ZoneState>(s));
+	}
+	overlay_ = layers_[static_cast<int>(ZoneState::Idle)].clone();
+	states_.assign(layout.zoneCount(), ZoneState::Idle);
+
+	// Which zone ends up on top at every pixel
+	cv::Mat owner;
+	layout.rasterize(owner, 1);
+	for (int i = 0; i < layout.zoneCount(); i++)
+	{
+		cv::Rect bounds = layout.zone(i).bounds & frame;
+		cv::Mat owned;
+		if (!bounds.empty())
+		{
+			cv::compare(owner(bounds), cv::Scalar(i + 1), owned, cv::CMP_EQ);
+		}
+		bounds_.push_back(bounds);
+		owned_.push_back(owned);
+	}
+
+	for (int y = 0; y < owner.rows; y++)
+	{
+		const ushort* p = owner.ptr<ushort>(y);
+		int x = 0;
+		while (x < owner.cols)
+		{
+			if (p[x] == 0)
+			{
+				x++;
+				continue;
+			}
+			int start = x;
+			while (x < owner.cols && p[x] != 0)
+			{
+				x++;
+			}
+			Run run = { y, start, x };
+			runs_.push_back(run);
+		}
+	}
+}
+
+void TileOverlay::update(const std::vector<ZoneState>& states)
+{
+	const int count = std::min(static_cast<int>(states.size()), static_cast<int>(states_.size()));
+	for (int i = 0; i < count; i++)
+	{
+		if (states[i] == states_[i])
+		{
+			continue;
+		}
+		states_[i] = states[i];
+		if (!bounds_[i].empty())
+		{
+			layers_[static_cast<int>(states[i])](bounds_[i]).copyTo(overlay_(bounds_[i]), owned_[i]);
+		}
+	}
+}
+
+void TileOverlay::composite(cv::Mat& frame) const
+{
+	CV_Assert(frame.type() == CV_8UC3);
+	for (const Run& run : runs_)
+	{
+		if (run.y >= frame.rows)
+		{
+			break;
+		}
+		int x1 = std::min(run.x1, frame.cols);
+		if (run.x0 >= x1)
+		{
+			continue;
+		}
+
+		uchar* dst = frame.ptr<uchar>(run.y) + 3 * run.x0;
+		const uchar* src = overlay_.ptr<uchar>(run.y) + 3 * run.x0;
+		if (alpha_ >= 255)
+		{
+			std::memcpy(dst, src, 3 * (x1 - run.x0));
+		}
+		else if (alpha_ > 0)
+		{
+			blendRow(dst, src, 3 * (x1 - run.x0), alpha_);
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "TileLayout.h"
+
+// Pre-rendered tile layer for the display. Every zone is drawn once per
+// state (idle, active, muted) when the overlay is built; after that a state
+// change copies the zone's pixels from the matching layer into the overlay,
+// and only for the zones that changed. Each outgoing frame gets the overlay
+// over the pixels the layout covers, kept as a list of row runs, so the
+// per-frame cost depends on the covered area rather than on how many zones
+// or labels there are.
+class TileOverlay
+{
+public:
+	explicit TileOverlay(const TileLayout& layout);
+
+	// Brings the overlay up to date with states (one per zone).
+	void update(const std::vector<ZoneState>& states);
+
+	// Puts the overlay on top of a BGR frame.
+	void composite(cv::Mat& frame) const;
+
+private:
+	struct Run
+	{
+		int y;
+		int x0;
+		int x1; // One past the last pixel
+	};
+
+	const TileLayout& layout_;
+	cv::Mat layers_[3];            // Every zone in one state
+	cv::Mat overlay_;              // Every zone in its current state
+	std::vector<cv::Mat> owned_;   // Per zone, where in its bounds it is on top
+	std::vector<cv::Rect> bounds_; // Zone bounds clipped to the layers
+	std::vector<ZoneState> states_;
+	std::vector<Run> runs_;
+	int alpha_;                    // Layout opacity, 0..255
+};
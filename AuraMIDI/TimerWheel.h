@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel for delayed items, one tick per slot.
+// Three levels of 256 slots cover 2^24 ticks ahead (about 4.6 hours at
+// 1 ms per tick), anything further is parked and filed again later. An
+// item is filed in the finest level its distance fits in and moves down a
+// level each time the level below wraps, so both scheduling and firing
+// are O(1) per item. Items live in a pool sized up
+// front and linked through indices, so nothing allocates after
+// construction.
+template <typename T>
+class TimerWheel
+{
+public:
+	explicit TimerWheel(size_t capacity)
+		: nodes_(capacity), free_(capacity > 0 ? 0 : -1), now_(0), pending_(0)
+	{
+		for (size_t i = 0; i < capacity; i++)
+		{
+			nodes_[i].next = i + 1 < capacity ? static_cast<int>(i + 1) : -1;
+		}
+		for (int level = 0; level < levels; level++)
+		{
+			for (int slot = 0; slot < slots; slot++)
+			{
+				heads_[level][slot] = -1;
+			}
+		}
+	}
+
+	// Files item to fire at tick; ticks already passed fire on the next
+	// advance. Returns false if the pool is full.
+	bool schedule(uint64_t tick, const T& item)
+	{
+		if (free_ < 0)
+		{
+			return false;
+		}
+		int index = free_;
+		free_ = nodes_[index].next;
+		nodes_[index].tick = tick > now_ ? tick : now_ + 1;
+		nodes_[index].item = item;
+		file(index);
+		pending_++;
+		return true;
+	}
+
+	// Moves time forward to tick, calling fire(item) for everything due, in
+	// tick order.
+	template <typename Fire>
+	void advance(uint64_t tick, Fire&& fire)
+	{
+		while (now_ < tick)
+		{
+			now_++;
+			// Pull the next stretch down from the coarser levels when the finer ones wrap
+			if ((now_ & (slots - 1)) == 0)
+			{
+				if (((now_ >> slotBits) & (slots - 1)) == 0)
+				{
+					cascade(2, (now_ >> (2 * slotBits)) & (slots - 1));
+				}
+				cascade(1, (now_ >> slotBits) & (slots - 1));
+			}
+
+			int& head = heads_[0][now_ & (slots - 1)];
+			int index = head;
+			head = -1;
+			while (index >= 0)
+			{
+				int next = nodes_[index].next;
+				fire(nodes_[index].item);
+				release(index);
+				index = next;
+			}
+		}
+	}
+
+	// Fires everything still pending at once, ignoring when it was due.
+	template <typename Fire>
+	void drain(Fire&& fire)
+	{
+		for (int level = 0; level < levels; level++)
+		{
+			for (int slot = 0; slot < slots; slot++)
+			{
+				int index = heads_[level][slot];
+				heads_[level][slot] = -1;
+				while (index >= 0)
+				{
+					int next = nodes_[index].next;
+					fire(nodes_[index].item);
+					release(index);
+					index = next;
+				}
+			}
+		}
+	}
+
+	uint64_t now() const { return now_; }
+	size_t pending() const { return pending_; }
+
+private:
+	static const int slotBits = 8;
+	static const int slots = 1 << slotBits;
+	static const int levels = 3;
+
+	struct Node
+	{
+		uint64_t tick = 0;
+		int next = -1;
+		T item;
+	};
+
+	void file(int index)
+	{
+		const uint64_t tick = nodes_[index].tick;
+		const uint64_t differing = tick ^ now_;
+		int level;
+		uint64_t slot;
+		if ((differing >> slotBits) == 0)
+		{
+			level = 0;
+			slot = tick;
+		}
+		else if ((differing >> (2 * slotBits)) == 0)
+		{
+			level = 1;
+			slot = tick >> slotBits;
+		}
+		else
+		{
+			level = 2;
+			slot = tick >> (2 * slotBits);
+			// Further than the wheel reaches: park in the last slot it can
+			// see, to be filed again when that slot comes round
+			if (slot - (now_ >> (2 * slotBits)) >= static_cast<uint64_t>(slots))
+			{
+				slot = (now_ >> (2 * slotBits)) + slots - 1;
+			}
+		}
+		int& head = heads_[level][slot & (slots - 1)];
+		nodes_[index].next = head;
+		head = index;
+	}
+
+	void cascade(int level, uint64_t slot)
+	{
+		int index = heads_[level][slot];
+		heads_[level][slot] = -1;
+		while (index >= 0)
+		{
+			int next = nodes_[index].next;
+			file(index);
+			index = next;
+		}
+	}
+
+	void release(int index)
+	{
+		nodes_[index].next = free_;
+		free_ = index;
+		pending_--;
+	}
+
+	std::vector<Node> nodes_;
+	int heads_[levels][slots];
+	int free_;
+	uint64_t now_;
+	size_t pending_;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer/single-consumer triple buffer.
+// The producer always owns one slot to write into, the consumer always owns
+// one slot to read from, and the third slot is exchanged between them.
+// Publishing never waits for the reader and the reader always gets the most
+// recently published value; anything published in between is overwritten.
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer()
+		: middle_(1), back_(0), front_(2)
+	{
+	}
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// Producer side: the slot to fill before calling publish().
+	T& writeBuffer()
+	{
+		return slots_[back_];
+	}
+
+	// Producer side: hands the filled slot to the consumer.
+	// Returns true if the previously published slot was never read, i.e. a
+	// value has been dropped.
+	bool publish()
+	{
+		uint8_t previous = middle_.exchange(static_cast<uint8_t>(back_ | freshBit), std::memory_order_acq_rel);
+		back_ = previous & indexMask;
+		return (previous & freshBit) != 0;
+	}
+
+	// Consumer side: takes the newest published slot if there is one.
+	// Returns false (and keeps the current read slot) when nothing new has
+	// been published since the last call.
+	bool acquire()
+	{
+		if ((middle_.load(std::memory_order_relaxed) & freshBit) == 0)
+		{
+			return false;
+		}
+		uint8_t previous = middle_.exchange(front_, std::memory_order_acq_rel);
+		front_ = previous & indexMask;
+		return true;
+	}
+
+	// Consumer side: the slot obtained by the last successful acquire().
+	const T& readBuffer() const
+	{
+		return slots_[front_];
+	}
+
+	T& readBuffer()
+	{
+		return slots_[front_];
+	}
+
+private:
+	static constexpr uint8_t freshBit = 0x4;
+	static constexpr uint8_t indexMask = 0x3;
+
+	T slots_[3];
+	std::atomic<uint8_t> middle_;
+	uint8_t back_;  // Touched by the producer only
+	uint8_t front_; // Touched by the consumer only
+};
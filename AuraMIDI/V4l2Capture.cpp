@@ -0,0 +1,317 @@
+#include "V4l2Capture.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+V4l2Capture::V4l2Capture()
+	: fd_(-1), stride_(0), fourcc_(0), haveSequence_(false), lastSequence_(0), skipped_(0)
+{
+}
+
+V4l2Capture::~V4l2Capture()
+{
+	close();
+}
+
+#ifdef __linux__
+
+static int xioctl(int fd, unsigned long request, void* arg)
+{
+	int result;
+	do
+	{
+		result = ioctl(fd, request, arg);
+	} while (result < 0 && errno == EINTR);
+	return result;
+}
+
+static uint32_t fourccOf(const std::string& name)
+{
+	if (name.size() != 4)
+	{
+		return 0;
+	}
+	return v4l2_fourcc(name[0], name[1], name[2], name[3]);
+}
+
+static std::string fourccName(uint32_t fourcc)
+{
+	return std::string({ char(fourcc & 0xFF), char(fourcc >> 8 & 0xFF), char(fourcc >> 16 & 0xFF), char(fourcc >> 24 & 0xFF) });
+}
+
+bool V4l2Capture::open(const CameraConfig& config)
+{
+	close();
+	const std::string path = "/dev/video" + std::to_string(config.device);
+	const uint32_t fourcc = fourccOf(config.format);
+	if (fourcc != V4L2_PIX_FMT_YUYV && fourcc != V4L2_PIX_FMT_NV12 && fourcc != V4L2_PIX_FMT_MJPEG)
+	{
+		std::cout << "V4L2: cannot capture " << config.format << ", only YUYV, NV12 or MJPG" << std::endl;
+		return false;
+	}
+
+	// Non-blocking, so read() can see whether newer frames are waiting
+	fd_ = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
+	if (fd_ < 0)
+	{
+		std::cout << "V4L2: cannot open " << path << ": " << std::strerror(errno) << std::endl;
+		return false;
+	}
+
+	v4l2_capability capability = {};
+	const uint32_t caps = xioctl(fd_, VIDIOC_QUERYCAP, &capability) < 0 ? 0
+		: (capability.capabilities & V4L2_CAP_DEVICE_CAPS) ? capability.device_caps : capability.capabilities;
+	if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+	{
+		std::cout << "V4L2: " << path << " is not a streaming capture device" << std::endl;
+		close();
+		return false;
+	}
+
+	// The configured size, or whatever the device is set to
+	v4l2_format format = {};
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	xioctl(fd_, VIDIOC_G_FMT, &format);
+	if (config.width > 0 && config.height > 0)
+	{
+		format.fmt.pix.width = config.width;
+		format.fmt.pix.height = config.height;
+	}
+	format.fmt.pix.pixelformat = fourcc;
+	format.fmt.pix.field = V4L2_FIELD_NONE;
+	if (xioctl(fd_, VIDIOC_S_FMT, &format) < 0 || format.fmt.pix.pixelformat != fourcc)
+	{
+		std::cout << "V4L2: " << path << " cannot capture " << config.format << std::endl;
+		close();
+		return false;
+	}
+	fourcc_ = fourcc;
+	size_ = cv::Size(format.fmt.pix.width, format.fmt.pix.height);
+	stride_ = format.fmt.pix.bytesperline;
+
+	if (config.fps > 0)
+	{
+		v4l2_streamparm parm = {};
+		parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		parm.parm.capture.timeperframe.numerator = 1;
+		parm.parm.capture.timeperframe.denominator = config.fps;
+		// Not every driver lets the rate be set; it then runs at its own
+		xioctl(fd_, VIDIOC_S_PARM, &parm);
+	}
+	v4l2_streamparm parm = {};
+	parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	double fps = 0;
+	if (xioctl(fd_, VIDIOC_G_PARM, &parm) == 0 && parm.parm.capture.timeperframe.numerator > 0)
+	{
+		fps = double(parm.parm.capture.timeperframe.denominator) / parm.parm.capture.timeperframe.numerator;
+	}
+
+	// The driver's queue, plus the two frames the pipeline may hold: the
+	// one being segmented and the one published for it next
+	v4l2_requestbuffers request = {};
+	request.count = std::max(config.buffers, 1) + 2;
+	request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	request.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(fd_, VIDIOC_REQBUFS, &request) < 0 || request.count < 3)
+	{
+		std::cout << "V4L2: " << path << " has too few buffers" << std::endl;
+		close();
+		return false;
+	}
+
+	for (uint32_t i = 0; i < request.count; i++)
+	{
+		v4l2_buffer buffer = {};
+		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory = V4L2_MEMORY_MMAP;
+		buffer.index = i;
+		void* start = MAP_FAILED;
+		if (xioctl(fd_, VIDIOC_QUERYBUF, &buffer) == 0)
+		{
+			start = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, buffer.m.offset);
+		}
+		if (start == MAP_FAILED || xioctl(fd_, VIDIOC_QBUF, &buffer) < 0)
+		{
+			std::cout << "V4L2: cannot map the buffers of " << path << std::endl;
+			if (start != MAP_FAILED)
+			{
+				munmap(start, buffer.length);
+			}
+			close();
+			return false;
+		}
+		buffers_.push_back({ start, buffer.length });
+	}
+
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0)
+	{
+		std::cout << "V4L2: cannot start " << path << ": " << std::strerror(errno) << std::endl;
+		close();
+		return false;
+	}
+	std::cout << "V4L2: " << capability.card << " on " << path << ", " << size_.width << "x" << size_.height << " "
+		<< fourccName(fourcc_) << " at " << fps << " fps, " << buffers_.size() << " buffers" << std::endl;
+	return true;
+}
+
+void V4l2Capture::close()
+{
+	if (fd_ < 0)
+	{
+		return;
+	}
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	xioctl(fd_, VIDIOC_STREAMOFF, &type);
+	for (const Buffer& buffer : buffers_)
+	{
+		munmap(buffer.start, buffer.length);
+	}
+	buffers_.clear();
+	::close(fd_);
+	fd_ = -1;
+	haveSequence_ = false;
+}
+
+bool V4l2Capture::dequeue(uint32_t& index, uint32_t& bytesUsed, uint32_t& sequence,
+	std::chrono::steady_clock::time_point& timestamp)
+{
+	v4l2_buffer buffer = {};
+	buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buffer.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(fd_, VIDIOC_DQBUF, &buffer) < 0)
+	{
+		return false;
+	}
+	if (buffer.flags & V4L2_BUF_FLAG_ERROR)
+	{
+		// Corrupt frame: straight back to the driver
+		release(buffer.index);
+		return false;
+	}
+	index = buffer.index;
+	bytesUsed = buffer.bytesused;
+	sequence = buffer.sequence;
+	// The driver's time of capture is on CLOCK_MONOTONIC, which is what
+	// steady_clock reads on Linux, so latencies count from the sensor
+	if ((buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+	{
+		timestamp = std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::seconds(buffer.timestamp.tv_sec) + std::chrono::microseconds(buffer.timestamp.tv_usec)));
+	}
+	else
+	{
+		timestamp = std::chrono::steady_clock::now();
+	}
+	return true;
+}
+
+bool V4l2Capture::read(CapturedFrame& frame, int timeoutMs)
+{
+	pollfd ready = { fd_, POLLIN, 0 };
+	if (fd_ < 0 || poll(&ready, 1, timeoutMs) <= 0)
+	{
+		return false;
+	}
+
+	uint32_t index, bytesUsed, sequence;
+	std::chrono::steady_clock::time_point timestamp;
+	if (!dequeue(index, bytesUsed, sequence, timestamp))
+	{
+		return false;
+	}
+	// Anything newer already waiting makes this one stale
+	uint32_t newer, newerBytes, newerSequence;
+	std::chrono::steady_clock::time_point newerTimestamp;
+	while (dequeue(newer, newerBytes, newerSequence, newerTimestamp))
+	{
+		release(index);
+		index = newer;
+		bytesUsed = newerBytes;
+		sequence = newerSequence;
+		timestamp = newerTimestamp;
+	}
+
+	// Gaps in the driver's numbering are frames it had no buffer for, or
+	// that were skipped above
+	if (haveSequence_ && sequence - lastSequence_ > 1)
+	{
+		skipped_.fetch_add(sequence - lastSequence_ - 1, std::memory_order_relaxed);
+	}
+	haveSequence_ = true;
+	lastSequence_ = sequence;
+	frame.timestamp = timestamp;
+
+	unsigned char* start = static_cast<unsigned char*>(buffers_[index].start);
+	switch (fourcc_)
+	{
+	case V4L2_PIX_FMT_YUYV:
+		frame.image = cv::Mat(size_, CV_8UC2, start, stride_);
+		frame.format = PixelFormat::Yuyv;
+		frame.buffer = index;
+		return true;
+	case V4L2_PIX_FMT_NV12:
+		frame.image = cv::Mat(size_.height * 3 / 2, size_.width, CV_8UC1, start, stride_);
+		frame.format = PixelFormat::Nv12;
+		frame.buffer = index;
+		return true;
+	default:
+		// MJPG: decoded into the frame's own image, reusing its allocation
+		cv::imdecode(cv::Mat(1, bytesUsed, CV_8UC1, start), cv::IMREAD_COLOR, &frame.image);
+		release(index);
+		frame.format = PixelFormat::Bgr;
+		frame.buffer = -1;
+		return !frame.image.empty();
+	}
+}
+
+void V4l2Capture::release(int buffer)
+{
+	v4l2_buffer queued = {};
+	queued.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	queued.memory = V4L2_MEMORY_MMAP;
+	queued.index = buffer;
+	if (fd_ >= 0 && buffer >= 0)
+	{
+		xioctl(fd_, VIDIOC_QBUF, &queued);
+	}
+}
+
+#else
+
+bool V4l2Capture::open(const CameraConfig&)
+{
+	std::cout << "V4L2: not available on this platform" << std::endl;
+	return false;
+}
+
+void V4l2Capture::close()
+{
+}
+
+bool V4l2Capture::read(CapturedFrame&, int)
+{
+	return false;
+}
+
+void V4l2Capture::release(int)
+{
+}
+
+bool V4l2Capture::dequeue(uint32_t&, uint32_t&, uint32_t&, std::chrono::steady_clock::time_point&)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "FrameCapture.h"
+
+// A camera driven through the Linux V4L2 API directly, rather than through
+// cv::VideoCapture: format, size and frame rate as configured, a short
+// queue of memory-mapped driver buffers, and the driver's own capture
+// time for every frame. Frames are handed out as cv::Mat headers on the
+// driver buffers, in the camera's own pixel layout; a buffer goes back to
+// the driver only on release(). MJPG frames are the exception: they are
+// decoded to BGR and their buffer goes back straight away.
+//
+// Elsewhere than on Linux open() always fails.
+class V4l2Capture
+{
+public:
+	V4l2Capture();
+	~V4l2Capture();
+
+	V4l2Capture(const V4l2Capture&) = delete;
+	V4l2Capture& operator=(const V4l2Capture&) = delete;
+
+	// Opens /dev/video<device> and starts streaming. Returns false, with
+	// the reason printed, if the device is missing or cannot do config.
+	bool open(const CameraConfig& config);
+	void close();
+	bool isOpened() const { return fd_ >= 0; }
+
+	// Waits up to timeoutMs for a frame. Frames that were already waiting
+	// behind it are skipped, so the one returned is always the newest.
+	bool read(CapturedFrame& frame, int timeoutMs);
+	// Gives frame.buffer back to the driver.
+	void release(int buffer);
+
+	// Frames the driver dropped or read() skipped; from any thread
+	uint64_t skippedFrames() const { return skipped_.load(std::memory_order_relaxed); }
+
+private:
+	struct Buffer
+	{
+		void* start;
+		size_t length;
+	};
+
+	bool dequeue(uint32_t& index, uint32_t& bytesUsed, uint32_t& sequence, std::chrono::steady_clock::time_point& timestamp);
+
+	int fd_;
+	std::vector<Buffer> buffers_;
+	cv::Size size_;
+	size_t stride_;
+	uint32_t fourcc_;
+	bool haveSequence_;
+	uint32_t lastSequence_;
+	std::atomic<uint64_t> skipped_; // Written by the capture thread, read by others
+};
@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <opencv2/opencv.hpp>
+#include <json/json.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Pipeline.h"
+#include "Segmentation.h"
+#include "V4l2Capture.h"
+
+// Mean milliseconds per call of fn over the given number of iterations.
+template <typename Fn>
+static double timeMs(int iterations, Fn fn)
+{
+	fn(); // warm-up, also allocates the outputs
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		fn();
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+// Compares the fused BGR -> HSV threshold kernel against
+// cvtColor + inRange at common camera resolutions, and classification of
+// native YUYV frames against converting them to BGR first.
+static int runSegmentationBench(int iterations)
+{
+	// "highlighter" entry of object.json
+	const HsvBounds bounds = { { 20, 59, 194 }, { 69, 163, 255 } };
+	const cv::Scalar lowerHsv(bounds.lower[0], bounds.lower[1], bounds.lower[2]);
+	const cv::Scalar upperHsv(bounds.upper[0], bounds.upper[1], bounds.upper[2]);
+	const cv::Size sizes[] = { cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080) };
+
+	SimdLevel best = detectSimdLevel();
+	std::vector<SimdLevel> levels = { SimdLevel::Scalar };
+	if (best >= SimdLevel::Sse41) levels.push_back(SimdLevel::Sse41);
+	if (best >= SimdLevel::Avx2) levels.push_back(SimdLevel::Avx2);
+
+	std::cout << "Segmentation, " << iterations << " iterations, best kernel: " << simdLevelName(best) << "\n\n";
+	std::cout << std::fixed << std::setprecision(3);
+
+	bool allExact = true;
+	for (const cv::Size& size : sizes)
+	{
+		cv::Mat bgr(size, CV_8UC3);
+		cv::randu(bgr, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::Mat hsv, expected, mask;
+
+		double baseline = timeMs(iterations, [&]() {
+			cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+			cv::inRange(hsv, lowerHsv, upperHsv, expected);
+		});
+		std::cout << size.width << "x" << size.height << "\n";
+		std::cout << "  cvtColor+inRange  " << std::setw(8) << baseline << " ms\n";
+
+		for (SimdLevel level : levels)
+		{
+			double fused = timeMs(iterations, [&]() {
+				segmentHsv(bgr, bounds, mask, level);
+			});
+			bool exact = cv::countNonZero(mask != expected) == 0;
+			allExact = allExact && exact;
+			std::cout << "  fused " << std::left << std::setw(11) << simdLevelName(level) << std::right
+				<< std::setw(8) << fused << " ms  x" << std::setprecision(2) << baseline / fused << std::setprecision(3)
+				<< (exact ? "" : "  MISMATCH") << "\n";
+		}
+	}
+
+	// Classifying the camera's YUYV as it is, against converting it to BGR
+	// first; the labels differ only where quantisation puts a colour on
+	// the other side of a threshold
+	ColourClassifier classifier({ { "highlighter", bounds } });
+	std::cout << "\nClassifying YUYV camera frames\n";
+	for (const cv::Size& size : sizes)
+	{
+		cv::Mat yuyv(size, CV_8UC2);
+		cv::randu(yuyv, cv::Scalar::all(0), cv::Scalar::all(256));
+		cv::Mat bgr, viaBgr, native;
+
+		double converted = timeMs(iterations, [&]() {
+			cv::cvtColor(yuyv, bgr, cv::COLOR_YUV2BGR_YUYV);
+			classifier.classify(bgr, PixelFormat::Bgr, viaBgr);
+		});
+		double direct = timeMs(iterations, [&]() {
+			classifier.classify(yuyv, PixelFormat::Yuyv, native);
+		});
+		const double agreement = 100.0 - 100.0 * cv::countNonZero(native != viaBgr) / native.total();
+		std::cout << size.width << "x" << size.height << "\n";
+		std::cout << "  cvtColor+classify " << std::setw(8) << converted << " ms\n";
+		std::cout << "  native            " << std::setw(8) << direct << " ms  x" << std::setprecision(2)
+			<< converted / direct << ", " << agreement << "% same labels" << std::setprecision(3) << "\n";
+	}
+	std::cout << std::endl;
+	return allExact ? 0 : 1;
+}
+
+// Reads a JSON file from the working directory, as the app does.
+static Json::Value readJson(const char* path)
+{
+	Json::Value data;
+	std::ifstream file(path);
+	Json::Reader reader;
+	if (file && !reader.parse(file, data))
+	{
+		std::cout << "Cannot parse " << path << ", ignoring it" << std::endl;
+		data = Json::Value();
+	}
+	return data;
+}
+
+// One line per event handed to the MIDI engine: frame, time in the clip,
+// the message bytes, and the gate of a Note On.
+static void writeEvents(std::ostream& out, const FrameContext& frame)
+{
+	const double ms = std::chrono::duration<double, std::milli>(frame.timestamp.time_since_epoch()).count();
+	for (const MidiEvent& event : frame.midi)
+	{
+		out << frame.sequence << ' ' << std::fixed << std::setprecision(1) << ms << std::hex << std::setfill('0');
+		for (int i = 0; i < event.size; i++)
+		{
+			out << ' ' << std::setw(2) << static_cast<int>(event.message[i]);
+		}
+		out << std::dec << std::setfill(' ');
+		if ((event.message[0] & 0xF0) == 0x90)
+		{
+			out << " gate " << event.gateMs;
+		}
+		out << '\n';
+	}
+}
+
+// Feeds every frame of a clip, or of a raw frame recording (read straight
+// from memory, so decoding takes no share of the time), through
+// segmentation, tracking, hit tests and MIDI output as fast as they go,
+// with object.json and layout.json from the working directory. MIDI goes
+// to no port at all, so nothing sounds, but every event the pipeline
+// produces is written to eventsPath, if given, for diffing against a
+// known good run. Timestamps come from the clip, so the events
+// are the same at any speed.
+static int runReplayBench(const std::string& clipPath, const std::string& eventsPath)
+{
+	FrameCapture clip(clipPath);
+	if (!clip.isOpened())
+	{
+		std::cout << "Cannot open " << clipPath << std::endl;
+		return 1;
+	}
+
+	const Json::Value data = readJson("object.json");
+	std::vector<MarkerColour> colours = loadMarkerColours(data);
+	if (colours.empty())
+	{
+		colours.push_back({ "highlighter", { { 20, 59, 194 }, { 69, 163, 255 } } });
+	}
+	ColourClassifier classifier(colours);
+	const Json::Value layoutData = readJson("layout.json");
+	const TileLayout layout = layoutData.isObject() ? TileLayout::fromJson(layoutData) : TileLayout::defaultLayout();
+	const PipelineConfig config = PipelineConfig::fromJson(data);
+
+	// No port at all: the engine shapes and counts every message, then
+	// drops it, so replay needs no MIDI system (no ALSA sequencer on a
+	// headless box)
+	LatencyReport latency;
+	MidiEngine midi(nullptr, config.midiEvents.capacity, config.midiEvents.policy, config.midiOutput, latency);
+	midi.start();
+	// Never started: no clock to follow, and pattern tiles only queue up
+	ClockSync clock;
+	ClockGenerator tempo(midi, config.tempo);
+	Sequencer sequencer(layout, midi, tempo, config.sequencer);
+	FramePipeline pipeline(clip, classifier, layout, midi, clock, tempo, sequencer, latency, config);
+
+	std::ofstream events;
+	if (!eventsPath.empty())
+	{
+		events.open(eventsPath);
+	}
+
+	CapturedFrame captured;
+	FrameContext frame;
+	uint64_t frames = 0;
+	uint64_t sent = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (clip.read(captured))
+	{
+		sent += pipeline.process(captured, frame, events.is_open());
+		frames++;
+		if (events.is_open())
+		{
+			writeEvents(events, frame);
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	midi.stop();
+
+	std::cout << "Replayed " << frames << " frames of " << clipPath << " in " << std::fixed << std::setprecision(3)
+		<< elapsed.count() << " s, " << std::setprecision(1) << frames / elapsed.count() << " frames/s, "
+		<< sent << " MIDI events" << (events.is_open() ? " written to " + eventsPath : "") << "\n";
+	midi.printStats(std::cout);
+	latency.print(std::cout);
+	return frames > 0 ? 0 : 1;
+}
+
+static const char* pixelFormatName(PixelFormat format)
+{
+	switch (format)
+	{
+	case PixelFormat::Yuyv: return "YUYV";
+	case PixelFormat::Nv12: return "NV12";
+	default: return "BGR";
+	}
+}
+
+// Streams from the V4L2 camera in object.json for the given number of
+// seconds in each format, or in just the one given, and prints what came
+// out: the first few frames one by one, then how many there were, how far
+// apart the driver stamped them, how old they were on arrival, and how
+// many were skipped. Run against vivid (modprobe vivid) it checks the
+// backend without a camera.
+static int runCameraBench(double seconds, const std::string& only)
+{
+	CameraConfig config = PipelineConfig::fromJson(readJson("object.json")).camera;
+	std::vector<std::string> formats = { "YUYV", "NV12", "MJPG" };
+	if (!only.empty())
+	{
+		formats = { only };
+	}
+
+	int failed = 0;
+	for (const std::string& format : formats)
+	{
+		config.format = format;
+		V4l2Capture camera;
+		if (!camera.open(config))
+		{
+			failed++;
+			continue;
+		}
+
+		using Ms = std::chrono::duration<double, std::milli>;
+		CapturedFrame frame;
+		uint64_t frames = 0;
+		uint64_t mismatched = 0;
+		double minInterval = 0, maxInterval = 0, totalInterval = 0, totalAge = 0;
+		std::chrono::steady_clock::time_point previous;
+		std::cout << std::fixed << std::setprecision(3);
+		const auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(seconds));
+		while (std::chrono::steady_clock::now() < end)
+		{
+			if (!camera.read(frame, 100))
+			{
+				continue;
+			}
+			const double age = Ms(std::chrono::steady_clock::now() - frame.timestamp).count();
+			const double interval = frames > 0 ? Ms(frame.timestamp - previous).count() : 0;
+			const int expectedType = frame.format == PixelFormat::Yuyv ? CV_8UC2
+				: frame.format == PixelFormat::Nv12 ? CV_8UC1 : CV_8UC3;
+			if (frame.image.type() != expectedType)
+			{
+				mismatched++;
+			}
+			if (frames < 5)
+			{
+				std::cout << "  frame " << frames << ": " << pixelFormatName(frame.format) << " " << frame.image.cols
+					<< "x" << frame.image.rows << ", stamped at " << Ms(frame.timestamp.time_since_epoch()).count()
+					<< " ms, " << interval << " ms after the last, " << age << " ms old\n";
+			}
+			if (frames > 0)
+			{
+				minInterval = frames == 1 ? interval : std::min(minInterval, interval);
+				maxInterval = std::max(maxInterval, interval);
+				totalInterval += interval;
+			}
+			totalAge += age;
+			previous = frame.timestamp;
+			frames++;
+			camera.release(frame.buffer);
+		}
+
+		std::cout << format << ": " << frames << " frames in " << std::setprecision(1) << seconds << " s";
+		if (frames > 1)
+		{
+			std::cout << ", " << std::setprecision(3) << totalInterval / (frames - 1) << " ms apart (" << minInterval
+				<< " to " << maxInterval << "), " << totalAge / frames << " ms old on arrival";
+		}
+		std::cout << ", " << camera.skippedFrames() << " skipped"
+			<< (mismatched > 0 ? ", " + std::to_string(mismatched) + " in the wrong layout" : "") << "\n" << std::endl;
+		if (frames == 0 || mismatched > 0)
+		{
+			failed++;
+		}
+	}
+	return failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	std::string mode = argc > 1 ? argv[1] : "segment";
+
+	if (mode == "segment")
+	{
+		int iterations = argc > 2 ? std::stoi(argv[2]) : 200;
+		return runSegmentationBench(iterations);
+	}
+	if (mode == "replay" && argc > 2)
+	{
+		return runReplayBench(argv[2], argc > 3 ? argv[3] : "");
+	}
+
+	if (mode == "camera")
+	{
+		return runCameraBench(argc > 2 ? std::stod(argv[2]) : 5.0, argc > 3 ? argv[3] : "");
+	}
+
+	std::cout << "Usage: auramidi_bench segment [iterations]\n"
+		<< "       auramidi_bench replay <clip or recording> [events.txt]\n"
+		<< "       auramidi_bench camera [seconds] [YUYV, NV12 or MJPG]" << std::endl;
+	return 1;
+}
@@ -171,11 +171,16 @@ class MidiOutJack: public MidiOutApi
   unsigned int getPortCount( void );
   std::string getPortName( unsigned int portNumber );
   void sendMessage( const unsigned char *message, size_t size );
+  void sendMessageAt( const unsigned char *message, size_t size, double timestamp, bool relative );
+  void sendMessages( const RtMidiShortMessage *messages, size_t count );
+  double getOutputTime( void );
+  bool isSchedulingSupported( void );
 
  protected:
   std::string clientName;
 
   void connect( void );
+  void queueMessage( const unsigned char *message, size_t size, double timestamp );
   void initialize( const std::string& clientName );
 };
 
@@ -215,9 +220,14 @@ class MidiOutAlsa: public MidiOutApi
   unsigned int getPortCount( void );
   std::string getPortName( unsigned int portNumber );
   void sendMessage( const unsigned char *message, size_t size );
+  void sendMessageAt( const unsigned char *message, size_t size, double timestamp, bool relative );
+  void sendMessages( const RtMidiShortMessage *messages, size_t count );
+  double getOutputTime( void );
+  bool isSchedulingSupported( void );
 
  protected:
   void initialize( const std::string& clientName );
+  void outputMessage( const unsigned char *message, size_t size, bool scheduled, double timestamp, bool relative );
 };
 
 #endif
@@ -449,6 +459,7 @@ class MidiOutDummy: public MidiOutApi
   unsigned int getPortCount( void ) { return 0; }
   std::string getPortName( unsigned int /*portNumber*/ ) { return ""; }
   void sendMessage( const unsigned char * /*message*/, size_t /*size*/ ) {}
+  void sendMessages( const RtMidiShortMessage * /*messages*/, size_t /*count*/ ) {}
 
  protected:
   void initialize( const std::string& /*clientName*/ ) {}
@@ -795,7 +806,7 @@ MidiInApi :: MidiInApi( unsigned int queueSizeLimit )
   // Allocate the MIDI queue.
   inputData_.queue.ringSize = queueSizeLimit;
   if ( inputData_.queue.ringSize > 0 )
-    inputData_.queue.ring = new MidiMessage[ inputData_.queue.ringSize ];
+    inputData_.queue.ring = new MidiQueue::Slot[ inputData_.queue.ringSize ];
 }
 
 MidiInApi :: ~MidiInApi( void )
@@ -861,6 +872,29 @@ double MidiInApi :: getMessage( std::vector<unsigned char> *message )
   return timeStamp;
 }
 
+const unsigned char *MidiInApi :: peekMessage( size_t *size, double *timeStamp )
+{
+  *size = 0;
+  if ( inputData_.usingCallback ) {
+    errorString_ = "RtMidiIn::peekMessage: a user callback is currently set for this port.";
+    error( RtMidiError::WARNING, errorString_ );
+    return 0;
+  }
+
+  const MidiQueue::Slot *slot = inputData_.queue.peek();
+  if ( !slot )
+    return 0;
+
+  *size = slot->size;
+  if ( timeStamp ) *timeStamp = slot->timeStamp;
+  return slot->data();
+}
+
+void MidiInApi :: consumeMessage( void )
+{
+  inputData_.queue.consume();
+}
+
 void MidiInApi :: setBufferSize( unsigned int size, unsigned int count )
 {
     inputData_.bufferSize = size;
@@ -868,11 +902,11 @@ void MidiInApi :: setBufferSize( unsigned int size, unsigned int count )
 }
 
 unsigned int MidiInApi::MidiQueue::size( unsigned int *__back,
-                                         unsigned int *__front )
+                                         unsigned int *__front ) const
 {
   // Access back/front members exactly once and make stack copies for
   // size calculation
-  unsigned int _back = back, _front = front, _size;
+  unsigned int _back = back.load( std::memory_order_acquire ), _front = front.load( std::memory_order_acquire ), _size;
   if ( _back >= _front )
     _size = _back - _front;
   else
@@ -885,45 +919,69 @@ unsigned int MidiInApi::MidiQueue::size( unsigned int *__back,
   return _size;
 }
 
-// As long as we haven't reached our queue size limit, push the message.
 bool MidiInApi::MidiQueue::push( const MidiInApi::MidiMessage& msg )
 {
-  // Local stack copies of front/back
-  unsigned int _back, _front, _size;
+  if ( msg.bytes.empty() )
+    return push( 0, 0, msg.timeStamp );
+  return push( &msg.bytes[0], msg.bytes.size(), msg.timeStamp );
+}
 
-  // Get back/front indexes exactly once and calculate current size
+// As long as we haven't reached our queue size limit, push the message.
+// Only the input thread calls this.
+bool MidiInApi::MidiQueue::push( const unsigned char *bytes, size_t nBytes, double timeStamp )
+{
+  unsigned int _back, _front, _size;
   _size = size( &_back, &_front );
+  if ( _size + 1 >= ringSize )
+    return false;
 
-  if ( _size < ringSize-1 )
-  {
-    ring[_back] = msg;
-    back = (back+1)%ringSize;
-    return true;
+  Slot &slot = ring[_back];
+  slot.timeStamp = timeStamp;
+  slot.size = nBytes;
+  if ( nBytes <= inlineSize ) {
+    for ( size_t i=0; i<nBytes; ++i ) slot.bytes[i] = bytes[i];
+  }
+  else {
+    // Reuses the capacity of earlier SysEx in this slot
+    slot.sysex.assign( bytes, bytes + nBytes );
   }
 
-  return false;
+  // Publish the slot contents together with the new back index
+  back.store( ( _back + 1 ) % ringSize, std::memory_order_release );
+  return true;
 }
 
 bool MidiInApi::MidiQueue::pop( std::vector<unsigned char> *msg, double* timeStamp )
 {
-  // Local stack copies of front/back
-  unsigned int _back, _front, _size;
-
-  // Get back/front indexes exactly once and calculate current size
-  _size = size( &_back, &_front );
-
-  if ( _size == 0 )
+  const Slot *slot = peek();
+  if ( !slot )
     return false;
 
   // Copy queued message to the vector pointer argument and then "pop" it.
-  msg->assign( ring[_front].bytes.begin(), ring[_front].bytes.end() );
-  *timeStamp = ring[_front].timeStamp;
-
-  // Update front
-  front = (front+1)%ringSize;
+  const unsigned char *bytes = slot->data();
+  msg->assign( bytes, bytes + slot->size );
+  *timeStamp = slot->timeStamp;
+  consume();
   return true;
 }
 
+const MidiInApi::MidiQueue::Slot *MidiInApi::MidiQueue::peek( void ) const
+{
+  unsigned int _front;
+  if ( size( 0, &_front ) == 0 )
+    return 0;
+  return &ring[_front];
+}
+
+void MidiInApi::MidiQueue::consume( void )
+{
+  unsigned int _front;
+  if ( size( 0, &_front ) == 0 )
+    return;
+  // Hand the slot back to the input thread
+  front.store( ( _front + 1 ) % ringSize, std::memory_order_release );
+}
+
 //*********************************************************************//
 //  Common MidiOutApi Definitions
 //*********************************************************************//
@@ -937,6 +995,21 @@ MidiOutApi :: ~MidiOutApi( void )
 {
 }
 
+void MidiOutApi :: sendMessageAt( const unsigned char *message, size_t size, double, bool )
+{
+  sendMessage( message, size );
+}
+
+void MidiOutApi :: sendMessages( const RtMidiShortMessage *messages, size_t count )
+{
+  for ( size_t i=0; i<count; ++i ) {
+    if ( messages[i].timestamp < 0.0 )
+      sendMessage( messages[i].bytes, messages[i].size );
+    else
+      sendMessageAt( messages[i].bytes, messages[i].size, messages[i].timestamp, false );
+  }
+}
+
 // *************************************************** //
 //
 // OS/API-specific methods.
@@ -1771,6 +1844,11 @@ struct AlsaMidiData {
 
 #define PORT_TYPE( pinfo, bits ) ((snd_seq_port_info_get_capability(pinfo) & (bits)) == (bits))
 
+// Output events the client can have in flight: the user-space buffer
+// holds this many before it has to be drained, and the kernel pool this
+// many queued or scheduled (2000 is the most the kernel allows).
+#define ALSA_OUTPUT_POOL_SIZE 2000
+
 //*********************************************************************//
 //  API: LINUX ALSA
 //  Class Definitions: MidiInAlsa
@@ -2375,6 +2453,7 @@ MidiOutAlsa :: ~MidiOutAlsa()
   if ( data->vport >= 0 ) snd_seq_delete_port( data->seq, data->vport );
   if ( data->coder ) snd_midi_event_free( data->coder );
   if ( data->buffer ) free( data->buffer );
+  if ( data->queue_id >= 0 ) snd_seq_free_queue( data->seq, data->queue_id );
   snd_seq_close( data->seq );
   delete data;
 }
@@ -2393,6 +2472,11 @@ void MidiOutAlsa :: initialize( const std::string& clientName )
   // Set client name.
   snd_seq_set_client_name( seq, clientName.c_str() );
 
+  // Make room for whole batches and for messages scheduled ahead; the
+  // defaults hold a few hundred events.  Failure keeps the defaults.
+  snd_seq_set_output_buffer_size( seq, ALSA_OUTPUT_POOL_SIZE * sizeof( snd_seq_event_t ) );
+  snd_seq_set_client_pool_output( seq, ALSA_OUTPUT_POOL_SIZE );
+
   // Save our api-specific connection information.
   AlsaMidiData *data = (AlsaMidiData *) new AlsaMidiData;
   data->seq = seq;
@@ -2416,6 +2500,32 @@ void MidiOutAlsa :: initialize( const std::string& clientName )
     return;
   }
   snd_midi_event_init( data->coder );
+
+  // A queue running on real time holds scheduled messages in the kernel
+  // until they are due.  Use the high-resolution timer when there is one;
+  // the default system timer only ticks once per jiffy.
+  data->queue_id = snd_seq_alloc_named_queue( seq, "RtMidi Output Queue" );
+  if ( data->queue_id >= 0 ) {
+#if defined(SND_TIMER_GLOBAL_HRTIMER)
+    snd_seq_queue_timer_t *qtimer;
+    snd_seq_queue_timer_alloca( &qtimer );
+    snd_timer_id_t *timerId;
+    snd_timer_id_alloca( &timerId );
+    if ( snd_seq_get_queue_timer( seq, data->queue_id, qtimer ) == 0 ) {
+      snd_timer_id_set_class( timerId, SND_TIMER_CLASS_GLOBAL );
+      snd_timer_id_set_sclass( timerId, SND_TIMER_SCLASS_NONE );
+      snd_timer_id_set_card( timerId, -1 );
+      snd_timer_id_set_device( timerId, SND_TIMER_GLOBAL_HRTIMER );
+      snd_timer_id_set_subdevice( timerId, 0 );
+      snd_seq_queue_timer_set_type( qtimer, SND_SEQ_TIMER_ALSA );
+      snd_seq_queue_timer_set_id( qtimer, timerId );
+      snd_seq_set_queue_timer( seq, data->queue_id, qtimer ); // Keeps the default timer on failure
+    }
+#endif
+    snd_seq_start_queue( seq, data->queue_id, NULL );
+    snd_seq_drain_output( seq );
+  }
+
   apiData_ = (void *) data;
 }
 
@@ -2568,6 +2678,128 @@ void MidiOutAlsa :: openVirtualPort( const std::string &portName )
 }
 
 void MidiOutAlsa :: sendMessage( const unsigned char *message, size_t size )
+{
+  outputMessage( message, size, false, 0.0, false );
+}
+
+void MidiOutAlsa :: sendMessageAt( const unsigned char *message, size_t size, double timestamp, bool relative )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( data->queue_id < 0 ) {
+    // No queue to hold it; late is better than lost
+    outputMessage( message, size, false, 0.0, false );
+    return;
+  }
+  outputMessage( message, size, true, timestamp, relative );
+}
+
+// Fills in a sequencer event for a short message without going through
+// the byte-stream parser.  Returns false for messages it does not handle.
+static bool encodeShortMessage( snd_seq_event_t *ev, const unsigned char *bytes, unsigned char size )
+{
+  if ( size == 0 ) return false;
+  const unsigned char status = bytes[0];
+  const unsigned char channel = status & 0x0F;
+
+  if ( status < 0xF0 ) {
+    if ( status < 0x80 ) return false; // Running status needs the parser
+    const unsigned char type = status & 0xF0;
+    if ( size != ( type == 0xC0 || type == 0xD0 ? 2 : 3 ) ) return false;
+    switch ( type ) {
+    case 0x80: snd_seq_ev_set_noteoff( ev, channel, bytes[1], bytes[2] ); break;
+    case 0x90: snd_seq_ev_set_noteon( ev, channel, bytes[1], bytes[2] ); break;
+    case 0xA0: snd_seq_ev_set_keypress( ev, channel, bytes[1], bytes[2] ); break;
+    case 0xB0: snd_seq_ev_set_controller( ev, channel, bytes[1], bytes[2] ); break;
+    case 0xC0: snd_seq_ev_set_pgmchange( ev, channel, bytes[1] ); break;
+    case 0xD0: snd_seq_ev_set_chanpress( ev, channel, bytes[1] ); break;
+    default:   snd_seq_ev_set_pitchbend( ev, channel, ( ( bytes[2] << 7 ) | bytes[1] ) - 8192 ); break;
+    }
+    return true;
+  }
+
+  snd_seq_event_type_t type;
+  switch ( status ) {
+  case 0xF2:
+    // Song position pointer, in MIDI beats
+    if ( size != 3 ) return false;
+    snd_seq_ev_set_fixed( ev );
+    ev->type = SND_SEQ_EVENT_SONGPOS;
+    ev->data.control.value = ( bytes[2] << 7 ) | bytes[1];
+    return true;
+  case 0xF8: type = SND_SEQ_EVENT_CLOCK; break;
+  case 0xFA: type = SND_SEQ_EVENT_START; break;
+  case 0xFB: type = SND_SEQ_EVENT_CONTINUE; break;
+  case 0xFC: type = SND_SEQ_EVENT_STOP; break;
+  case 0xFE: type = SND_SEQ_EVENT_SENSING; break;
+  case 0xFF: type = SND_SEQ_EVENT_RESET; break;
+  default: return false;
+  }
+  if ( size != 1 ) return false;
+  snd_seq_ev_set_fixed( ev );
+  ev->type = type;
+  return true;
+}
+
+void MidiOutAlsa :: sendMessages( const RtMidiShortMessage *messages, size_t count )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+
+  for ( size_t i=0; i<count; ++i ) {
+    const RtMidiShortMessage &message = messages[i];
+    snd_seq_event_t ev;
+    snd_seq_ev_clear( &ev );
+    snd_seq_ev_set_source( &ev, data->vport );
+    snd_seq_ev_set_subs( &ev );
+    if ( message.timestamp >= 0.0 && data->queue_id >= 0 ) {
+      snd_seq_real_time_t time;
+      time.tv_sec = (unsigned int) message.timestamp;
+      time.tv_nsec = (unsigned int) ( ( message.timestamp - time.tv_sec ) * 1e9 );
+      snd_seq_ev_schedule_real( &ev, data->queue_id, 0, &time );
+    }
+    else
+      snd_seq_ev_set_direct( &ev );
+
+    if ( !encodeShortMessage( &ev, message.bytes, message.size ) ) {
+      // Anything else goes through the parser, from a clean state
+      snd_midi_event_reset_encode( data->coder );
+      long result = snd_midi_event_encode( data->coder, message.bytes, message.size, &ev );
+      if ( result < 0 || ev.type == SND_SEQ_EVENT_NONE ) {
+        errorString_ = "MidiOutAlsa::sendMessages: not a complete short message, skipped.";
+        error( RtMidiError::WARNING, errorString_ );
+        continue;
+      }
+    }
+
+    // Buffered in user space; written out below, or by ALSA should the
+    // buffer fill up
+    if ( snd_seq_event_output( data->seq, &ev ) < 0 ) {
+      errorString_ = "MidiOutAlsa::sendMessages: error sending MIDI message to port.";
+      error( RtMidiError::WARNING, errorString_ );
+      break;
+    }
+  }
+  snd_seq_drain_output( data->seq );
+}
+
+double MidiOutAlsa :: getOutputTime( void )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( data->queue_id < 0 ) return 0.0;
+
+  snd_seq_queue_status_t *status;
+  snd_seq_queue_status_alloca( &status );
+  if ( snd_seq_get_queue_status( data->seq, data->queue_id, status ) < 0 ) return 0.0;
+  const snd_seq_real_time_t *time = snd_seq_queue_status_get_real_time( status );
+  return time->tv_sec + time->tv_nsec * 1e-9;
+}
+
+bool MidiOutAlsa :: isSchedulingSupported( void )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  return data->queue_id >= 0;
+}
+
+void MidiOutAlsa :: outputMessage( const unsigned char *message, size_t size, bool scheduled, double timestamp, bool relative )
 {
   long result;
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
@@ -2591,13 +2823,23 @@ void MidiOutAlsa :: sendMessage( const unsigned char *message, size_t size )
 
   for ( unsigned int i=0; i<nBytes; ++i ) data->buffer[i] = message[i];
 
+  snd_seq_real_time_t time;
+  if ( scheduled ) {
+    if ( timestamp < 0.0 ) timestamp = 0.0;
+    time.tv_sec = (unsigned int) timestamp;
+    time.tv_nsec = (unsigned int) ( ( timestamp - time.tv_sec ) * 1e9 );
+  }
+
   unsigned int offset = 0;
   while (offset < nBytes) {
     snd_seq_event_t ev;
     snd_seq_ev_clear( &ev );
     snd_seq_ev_set_source( &ev, data->vport );
     snd_seq_ev_set_subs( &ev );
-    snd_seq_ev_set_direct( &ev );
+    if ( scheduled )
+      snd_seq_ev_schedule_real( &ev, data->queue_id, relative ? 1 : 0, &time );
+    else
+      snd_seq_ev_set_direct( &ev );
     result = snd_midi_event_encode( data->coder, data->buffer + offset,
                                     (long)(nBytes - offset), &ev );
     if ( result < 0 ) {
@@ -3987,6 +4229,7 @@ void MidiOutWinUWP::sendMessage(const unsigned char* message, size_t size)
 #include <jack/jack.h>
 #include <jack/midiport.h>
 #include <jack/ringbuffer.h>
+#include <string.h>
 #include <pthread.h>
 #include <sched.h>
 #ifdef HAVE_SEMAPHORE
@@ -3994,6 +4237,22 @@ void MidiOutWinUWP::sendMessage(const unsigned char* message, size_t size)
 #endif
 
 #define JACK_RINGBUFFER_SIZE 16384 // Default size for ringbuffer
+#define JACK_SCHEDULED_SIZE 1024   // Timestamped output messages waiting for their period
+
+// Output goes through the ringbuffer as a record header followed by the
+// message bytes.  time is in microseconds on the jack_get_time() clock,
+// or 0 to send in the next period.
+struct JackRecordHeader {
+  int size;
+  jack_time_t time;
+};
+
+// A short output message waiting for the period it falls in.
+struct JackScheduledEvent {
+  jack_nframes_t frame;
+  unsigned char size;
+  unsigned char bytes[3];
+};
 
 struct JackMidiData {
   jack_client_t *client;
@@ -4001,6 +4260,8 @@ struct JackMidiData {
   jack_ringbuffer_t *buff;
   int buffMaxWrite; // actual writable size, usually 1 less than ringbuffer
   jack_time_t lastTime;
+  JackScheduledEvent scheduled[JACK_SCHEDULED_SIZE]; // Sorted by frame; process thread only
+  int scheduledCount;
 #ifdef HAVE_SEMAPHORE
   sem_t sem_cleanup;
   sem_t sem_needpost;
@@ -4275,23 +4536,60 @@ static int jackProcessOut( jack_nframes_t nframes, void *arg )
 {
   JackMidiData *data = (JackMidiData *) arg;
   jack_midi_data_t *midiData;
-  int space;
+  JackRecordHeader header;
 
   // Is port created?
   if ( data->port == NULL ) return 0;
 
   void *buff = jack_port_get_buffer( data->port, nframes );
   jack_midi_clear_buffer( buff );
+  const jack_nframes_t periodStart = jack_last_frame_time( data->client );
+
+  // Untimed messages go out at the start of the period.  Timed ones are
+  // sorted in among those waiting, so the order they were sent in does
+  // not matter.
+  while ( jack_ringbuffer_peek( data->buff, (char *) &header, sizeof( header ) ) == sizeof( header ) &&
+          jack_ringbuffer_read_space( data->buff ) >= sizeof( header ) + header.size ) {
+    jack_ringbuffer_read_advance( data->buff, sizeof( header ) );
+
+    if ( header.time != 0 && header.size <= 3 && data->scheduledCount < JACK_SCHEDULED_SIZE ) {
+      JackScheduledEvent event;
+      event.frame = jack_time_to_frames( data->client, header.time );
+      event.size = (unsigned char) header.size;
+      jack_ringbuffer_read( data->buff, (char *) event.bytes, (size_t) header.size );
+
+      int i = data->scheduledCount++;
+      while ( i > 0 && (int32_t) ( data->scheduled[i - 1].frame - event.frame ) > 0 ) {
+        data->scheduled[i] = data->scheduled[i - 1];
+        --i;
+      }
+      data->scheduled[i] = event;
+      continue;
+    }
 
-  while ( jack_ringbuffer_peek( data->buff, (char *) &space, sizeof( space ) ) == sizeof(space) &&
-          jack_ringbuffer_read_space( data->buff ) >= sizeof(space) + space ) {
-    jack_ringbuffer_read_advance( data->buff, sizeof(space) );
-
-    midiData = jack_midi_event_reserve( buff, 0, space );
+    midiData = jack_midi_event_reserve( buff, 0, header.size );
     if ( midiData )
-        jack_ringbuffer_read( data->buff, (char *) midiData, (size_t) space );
+        jack_ringbuffer_read( data->buff, (char *) midiData, (size_t) header.size );
     else
-        jack_ringbuffer_read_advance( data->buff, (size_t) space );
+        jack_ringbuffer_read_advance( data->buff, (size_t) header.size );
+  }
+
+  // Place everything due in this period at its frame; anything late goes
+  // at the start.  Offsets only grow, as JACK requires.
+  int due = 0;
+  while ( due < data->scheduledCount ) {
+    const JackScheduledEvent &event = data->scheduled[due];
+    int32_t offset = (int32_t) ( event.frame - periodStart );
+    if ( offset >= (int32_t) nframes ) break;
+    if ( offset < 0 ) offset = 0;
+    midiData = jack_midi_event_reserve( buff, (jack_nframes_t) offset, event.size );
+    if ( midiData )
+      memcpy( midiData, event.bytes, event.size );
+    ++due;
+  }
+  if ( due > 0 ) {
+    data->scheduledCount -= due;
+    memmove( data->scheduled, data->scheduled + due, data->scheduledCount * sizeof( JackScheduledEvent ) );
   }
 
 #ifdef HAVE_SEMAPHORE
@@ -4314,6 +4612,7 @@ void MidiOutJack :: initialize( const std::string& clientName )
 
   data->port = NULL;
   data->client = NULL;
+  data->scheduledCount = 0;
 #ifdef HAVE_SEMAPHORE
   sem_init( &data->sem_cleanup, 0, 0 );
   sem_init( &data->sem_needpost, 0, 0 );
@@ -4498,18 +4797,66 @@ void MidiOutJack :: setPortName( const std::string &portName )
 
 void MidiOutJack :: sendMessage( const unsigned char *message, size_t size )
 {
-  int nBytes = static_cast<int>(size);
+  queueMessage( message, size, -1.0 );
+}
+
+void MidiOutJack :: sendMessageAt( const unsigned char *message, size_t size, double timestamp, bool relative )
+{
+  if ( relative ) timestamp += getOutputTime();
+  queueMessage( message, size, timestamp );
+}
+
+void MidiOutJack :: sendMessages( const RtMidiShortMessage *messages, size_t count )
+{
+  JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+
+  // Wait for room once for the whole batch, when it fits at all
+  size_t total = 0;
+  for ( size_t i=0; i<count; ++i ) total += sizeof( JackRecordHeader ) + messages[i].size;
+  if ( total > (size_t) data->buffMaxWrite ) {
+    for ( size_t i=0; i<count; ++i ) queueMessage( messages[i].bytes, messages[i].size, messages[i].timestamp );
+    return;
+  }
+  while ( jack_ringbuffer_write_space( data->buff ) < total )
+    sched_yield();
+
+  for ( size_t i=0; i<count; ++i ) {
+    JackRecordHeader header;
+    header.size = messages[i].size;
+    header.time = messages[i].timestamp < 0.0 ? 0 : (jack_time_t) ( messages[i].timestamp * 1e6 ) + 1;
+    jack_ringbuffer_write( data->buff, ( char * ) &header, sizeof( header ) );
+    jack_ringbuffer_write( data->buff, ( const char * ) messages[i].bytes, header.size );
+  }
+}
+
+double MidiOutJack :: getOutputTime( void )
+{
+  return jack_get_time() * 1e-6;
+}
+
+bool MidiOutJack :: isSchedulingSupported( void )
+{
+  JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+  return data->client != NULL;
+}
+
+void MidiOutJack :: queueMessage( const unsigned char *message, size_t size, double timestamp )
+{
+  JackRecordHeader header;
+  header.size = static_cast<int>(size);
+  // Rounded up, and never 0, which means untimed
+  header.time = timestamp < 0.0 ? 0 : (jack_time_t) ( timestamp * 1e6 ) + 1;
   JackMidiData *data = static_cast<JackMidiData *> (apiData_);
 
-  if ( size + sizeof(nBytes) > (size_t) data->buffMaxWrite )
+  if ( size + sizeof(header) > (size_t) data->buffMaxWrite )
       return;
 
-  while ( jack_ringbuffer_write_space(data->buff) < sizeof(nBytes) + size )
+  while ( jack_ringbuffer_write_space(data->buff) < sizeof(header) + size )
       sched_yield();
 
   // Write full message to buffer
-  jack_ringbuffer_write( data->buff, ( char * ) &nBytes, sizeof( nBytes ) );
-  jack_ringbuffer_write( data->buff, ( const char * ) message, nBytes );
+  jack_ringbuffer_write( data->buff, ( char * ) &header, sizeof( header ) );
+  jack_ringbuffer_write( data->buff, ( const char * ) message, header.size );
 }
 
 #endif  // __UNIX_JACK__
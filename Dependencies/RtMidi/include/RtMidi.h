@@ -77,6 +77,7 @@
                         "." RTMIDI_TOSTRING(RTMIDI_VERSION_PATCH)
 #endif
 
+#include <atomic>
 #include <exception>
 #include <iostream>
 #include <string>
@@ -145,6 +146,19 @@ class RTMIDI_DLL_PUBLIC RtMidiError : public std::exception
  */
 typedef void (*RtMidiErrorCallback)( RtMidiError::Type type, const std::string &errorText, void *userData );
 
+//! A short MIDI message, already encoded, for RtMidiOut::sendMessages().
+/*!
+    bytes holds a channel, system common or system real-time message of
+    size bytes (1 to 3).  timestamp is a time on the clock returned by
+    RtMidiOut::getOutputTime(), or negative to send the message at once.
+*/
+struct RtMidiShortMessage
+{
+  unsigned char bytes[3];
+  unsigned char size;
+  double timestamp;
+};
+
 class MidiApi;
 
 class RTMIDI_DLL_PUBLIC RtMidi
@@ -392,6 +406,20 @@ class RTMIDI_DLL_PUBLIC RtMidiIn : public RtMidi
   */
   double getMessage( std::vector<unsigned char> *message );
 
+  //! Return the next available MIDI message in the input queue without copying it.
+  /*!
+    Returns a pointer to the bytes of the oldest queued message and sets
+    \e size and, if given, \e timeStamp (the event delta-time in
+    seconds), or returns NULL if no message is available.  The message
+    stays queued, and the pointer valid, until consumeMessage() is
+    called.  Call both from the thread that would otherwise call
+    getMessage(); neither can be used while a callback is set.
+  */
+  const unsigned char *peekMessage( size_t *size, double *timeStamp = 0 );
+
+  //! Remove the message returned by peekMessage() from the input queue.
+  void consumeMessage( void );
+
   //! Set an error callback function to be invoked when an error has occurred.
   /*!
     The callback function will be called whenever an error has occurred. It is best
@@ -510,6 +538,41 @@ class RTMIDI_DLL_PUBLIC RtMidiOut : public RtMidi
   */
   void sendMessage( const unsigned char *message, size_t size );
 
+  //! Send a single message out an open MIDI output port at a given time.
+  /*!
+      The message is handed to the driver right away and leaves it at the
+      requested time, however late the calling thread runs afterwards.
+      APIs without scheduled output (see isSchedulingSupported()) send the
+      message immediately.  Messages still scheduled when the port is
+      closed are discarded.
+
+      \param message   A pointer to the MIDI message as raw bytes
+      \param size      Length of the MIDI message in bytes
+      \param timestamp Seconds from now if relative is true, otherwise a
+                       time on the clock returned by getOutputTime()
+      \param relative  Whether timestamp is relative to now
+  */
+  void sendMessageAt( const unsigned char *message, size_t size, double timestamp, bool relative = true );
+
+  //! Send a batch of short messages out an open MIDI output port.
+  /*!
+      Messages are sent in order, each immediately or at its timestamp as
+      with sendMessageAt(), but are handed to the driver together: with
+      ALSA the whole batch costs a single write to the sequencer.  Nothing
+      is allocated.  Messages the API cannot handle are reported as
+      warnings and skipped.
+
+      \param messages A pointer to the first of count messages
+      \param count    Number of messages
+  */
+  void sendMessages( const RtMidiShortMessage *messages, size_t count );
+
+  //! Current time, in seconds, of the clock absolute timestamps refer to.
+  double getOutputTime( void );
+
+  //! Returns true if the current API holds scheduled messages until their time.
+  bool isSchedulingSupported( void );
+
   //! Set an error callback function to be invoked when an error has occurred.
   /*!
     The callback function will be called whenever an error has occurred. It is best
@@ -579,6 +642,8 @@ class RTMIDI_DLL_PUBLIC MidiInApi : public MidiApi
   void cancelCallback( void );
   virtual void ignoreTypes( bool midiSysex, bool midiTime, bool midiSense );
   virtual double getMessage( std::vector<unsigned char> *message );
+  const unsigned char *peekMessage( size_t *size, double *timeStamp );
+  void consumeMessage( void );
   virtual void setBufferSize( unsigned int size, unsigned int count );
 
   // A MIDI structure used internally by the class to store incoming
@@ -594,18 +659,38 @@ class RTMIDI_DLL_PUBLIC MidiInApi : public MidiApi
       : bytes(0), timeStamp(0.0) {}
   };
 
+  // Wait-free single-producer/single-consumer ring of fixed slots.  The
+  // input thread pushes, the thread calling getMessage() or peek/consume
+  // pops.  Messages up to inlineSize bytes are copied into the slot
+  // itself; only longer ones (SysEx) use the slot's own buffer, which
+  // keeps its capacity, so once running nothing is allocated.
   struct MidiQueue {
-    unsigned int front;
-    unsigned int back;
+    static const unsigned int inlineSize = 8;
+
+    struct Slot {
+      double timeStamp;
+      size_t size;
+      unsigned char bytes[inlineSize];
+      std::vector<unsigned char> sysex; // Used when size > inlineSize
+
+      Slot() : timeStamp(0.0), size(0) {}
+      const unsigned char *data() const { return size > inlineSize ? &sysex[0] : bytes; }
+    };
+
+    std::atomic<unsigned int> front;
+    std::atomic<unsigned int> back;
     unsigned int ringSize;
-    MidiMessage *ring;
+    Slot *ring;
 
     // Default constructor.
     MidiQueue()
       : front(0), back(0), ringSize(0), ring(0) {}
     bool push( const MidiMessage& );
+    bool push( const unsigned char *bytes, size_t size, double timeStamp );
     bool pop( std::vector<unsigned char>*, double* );
-    unsigned int size( unsigned int *back=0, unsigned int *front=0 );
+    const Slot *peek( void ) const;
+    void consume( void );
+    unsigned int size( unsigned int *back=0, unsigned int *front=0 ) const;
   };
 
   // The RtMidiInData structure is used to pass private class data to
@@ -641,6 +726,14 @@ class RTMIDI_DLL_PUBLIC MidiOutApi : public MidiApi
   MidiOutApi( void );
   virtual ~MidiOutApi( void );
   virtual void sendMessage( const unsigned char *message, size_t size ) = 0;
+
+  // APIs that can schedule output override these; by default messages go
+  // out immediately and the output clock stands still.  sendMessages()
+  // falls back to one sendMessage() or sendMessageAt() call per message.
+  virtual void sendMessageAt( const unsigned char *message, size_t size, double timestamp, bool relative );
+  virtual void sendMessages( const RtMidiShortMessage *messages, size_t count );
+  virtual double getOutputTime( void ) { return 0.0; }
+  virtual bool isSchedulingSupported( void ) { return false; }
 };
 
 // **************************************************************** //
@@ -660,6 +753,8 @@ inline unsigned int RtMidiIn :: getPortCount( void ) { return rtapi_->getPortCou
 inline std::string RtMidiIn :: getPortName( unsigned int portNumber ) { return rtapi_->getPortName( portNumber ); }
 inline void RtMidiIn :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense ) { static_cast<MidiInApi *>(rtapi_)->ignoreTypes( midiSysex, midiTime, midiSense ); }
 inline double RtMidiIn :: getMessage( std::vector<unsigned char> *message ) { return static_cast<MidiInApi *>(rtapi_)->getMessage( message ); }
+inline const unsigned char *RtMidiIn :: peekMessage( size_t *size, double *timeStamp ) { return static_cast<MidiInApi *>(rtapi_)->peekMessage( size, timeStamp ); }
+inline void RtMidiIn :: consumeMessage( void ) { static_cast<MidiInApi *>(rtapi_)->consumeMessage(); }
 inline void RtMidiIn :: setErrorCallback( RtMidiErrorCallback errorCallback, void *userData ) { rtapi_->setErrorCallback(errorCallback, userData); }
 inline void RtMidiIn :: setBufferSize( unsigned int size, unsigned int count ) { static_cast<MidiInApi *>(rtapi_)->setBufferSize(size, count); }
 
@@ -672,6 +767,10 @@ inline unsigned int RtMidiOut :: getPortCount( void ) { return rtapi_->getPortCo
 inline std::string RtMidiOut :: getPortName( unsigned int portNumber ) { return rtapi_->getPortName( portNumber ); }
 inline void RtMidiOut :: sendMessage( const std::vector<unsigned char> *message ) { static_cast<MidiOutApi *>(rtapi_)->sendMessage( &message->at(0), message->size() ); }
 inline void RtMidiOut :: sendMessage( const unsigned char *message, size_t size ) { static_cast<MidiOutApi *>(rtapi_)->sendMessage( message, size ); }
+inline void RtMidiOut :: sendMessageAt( const unsigned char *message, size_t size, double timestamp, bool relative ) { static_cast<MidiOutApi *>(rtapi_)->sendMessageAt( message, size, timestamp, relative ); }
+inline void RtMidiOut :: sendMessages( const RtMidiShortMessage *messages, size_t count ) { static_cast<MidiOutApi *>(rtapi_)->sendMessages( messages, count ); }
+inline double RtMidiOut :: getOutputTime( void ) { return static_cast<MidiOutApi *>(rtapi_)->getOutputTime(); }
+inline bool RtMidiOut :: isSchedulingSupported( void ) { return static_cast<MidiOutApi *>(rtapi_)->isSchedulingSupported(); }
 inline void RtMidiOut :: setErrorCallback( RtMidiErrorCallback errorCallback, void *userData ) { rtapi_->setErrorCallback(errorCallback, userData); }
 
 #endif